@@ -0,0 +1,25 @@
+#version 430
+
+layout(local_size_x = 8, local_size_y = 8, local_size_z = 8) in;
+layout(binding = 1) uniform sampler3D rawVolume;
+layout(binding = 2) uniform sampler1D transferLUT;
+layout(binding = 3) uniform sampler1D opacityLUT;
+layout(binding = 4) writeonly uniform image3D classifiedVolume;
+
+uniform ivec3 scanResolution;
+
+// bakes the transfer functions into the volume so raymarching only has to do one fetch per step
+void main()
+{
+    ivec3 index = ivec3(gl_GlobalInvocationID.xyz);
+    if (any(greaterThanEqual(index, scanResolution)))
+    {
+        return;
+    }
+
+    float density = texelFetch(rawVolume, index, 0).r;
+    vec3 color = texture(transferLUT, density).rgb;
+    float opacity = texture(opacityLUT, density).r;
+
+    imageStore(classifiedVolume, index, vec4(color, opacity));
+}
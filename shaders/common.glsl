@@ -3,6 +3,7 @@ const float twoPi = pi * 2.0;
 const float invPi = 1.0 / pi;
 const float invFourPi = 1.0 / (4.0 * pi);
 const float e = 2.718281828459045;
+const float focalLength = 1.0 / tan(radians(45.0) * 0.5); // of the camera rays, a 45 degree vertical fov
 
 uint state[4];
 
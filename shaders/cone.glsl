@@ -0,0 +1,31 @@
+// transmittance along the diffuse cones of raymarch_direct.glsl for passes that precompute lighting from the bake,
+// kept to the same cone spread and extinction scale so their results match what the direct pass would trace
+
+const float coneStepSize = 0.001;
+const float coneSpread = 0.325f;
+const float coneMipmapHardcap = 5.4f;
+const float diffuseCubemapLod = 7.416f;
+
+// distance to where the ray leaves the unit box, ro is inside it
+float unitBoxExit(vec3 ro, vec3 rd)
+{
+    vec3 id = 1 / rd;
+    vec3 tmax = max(-ro * id, (vec3(1.0) - ro) * id);
+    return min(min(tmax.x, tmax.y), tmax.z);
+}
+
+vec3 diffuseConeTransmittance(sampler3D sigmaVolume, vec3 ro, vec3 rd, float bakeLodBias)
+{
+    float tEnd = unitBoxExit(ro, rd);
+    float t = rand() * coneStepSize;
+    vec3 linearDensity = vec3(0.0);
+    while (t < tEnd)
+    {
+        float l = (coneSpread / coneStepSize) * t + coneStepSize;
+        float level = log2(l) + bakeLodBias;
+        vec4 bakedVal = textureLod(sigmaVolume, ro + t * rd, min(coneMipmapHardcap + bakeLodBias, level));
+        linearDensity += vec3(pow(bakedVal.a, 1.5f) * l) * (vec3(1.0) - bakedVal.rgb);
+        t += l;
+    }
+    return exp(-linearDensity * 10.0);
+}
@@ -1,8 +1,14 @@
 #version 450 core
 readonly restrict uniform layout(rgba16f) image2D image;
 uniform uint samples;
+layout(location = 2) uniform uint activeSamples; // the rest of each pixel's samples are stale while the quality governor has lowered quality
+layout(location = 3) uniform ivec2 renderSize; // pixels rendered at the current render scale, the top left of the image
+layout(location = 4) uniform vec2 outputSize;
 layout(location=0) out vec4 color;
 
+// upscaling: a tap's weight falls off with its relative luminance difference to the nearest tap, in units of this
+const float edgeSharpness = 0.1;
+
 // https://knarkowicz.wordpress.com/2016/01/06/aces-filmic-tone-mapping-curve/
 vec3 ACESFilm(vec3 x)
 {
@@ -14,14 +20,55 @@ vec3 ACESFilm(vec3 x)
     return clamp((x*(a*x+b))/(x*(c*x+d)+e), 0.0, 1.0);
 }
 
-void main(void) 
+vec3 resolve(ivec2 pixel)
 {
 	vec3 col3 = vec3(0.0);
-	for(uint i = 0; i < samples; i++)
+	for(uint i = 0; i < activeSamples; i++)
+	{
+		col3 += imageLoad(image, pixel * ivec2(samples, 1) + ivec2(i, 0)).xyz;
+	}
+	return col3 / activeSamples;
+}
+
+float luminance(vec3 col)
+{
+	return dot(col, vec3(0.2126, 0.7152, 0.0722));
+}
+
+// bilinear upscale that leans towards the nearest rendered pixel across edges so they stay sharp instead of blurring
+vec3 upscale(vec2 fragCoord)
+{
+	vec2 p = fragCoord * vec2(renderSize) / outputSize - 0.5;
+	ivec2 p0 = ivec2(floor(p));
+	vec2 f = p - vec2(p0);
+
+	vec3 taps[4];
+	float bilinear[4] = float[](
+		(1.0 - f.x) * (1.0 - f.y), f.x * (1.0 - f.y),
+		(1.0 - f.x) * f.y, f.x * f.y);
+	int nearest = 0;
+	for (int i = 0; i < 4; i++)
+	{
+		taps[i] = resolve(clamp(p0 + ivec2(i & 1, i >> 1), ivec2(0), renderSize - 1));
+		nearest = bilinear[i] > bilinear[nearest] ? i : nearest;
+	}
+
+	float nearestLum = luminance(taps[nearest]);
+	vec3 sum = vec3(0.0);
+	float weightSum = 0.0;
+	for (int i = 0; i < 4; i++)
 	{
-		col3 += imageLoad(image, ivec2(gl_FragCoord.xy) * ivec2(samples, 1) + ivec2(i, 0)).xyz;
+		float difference = abs(luminance(taps[i]) - nearestLum) / (nearestLum + 0.05);
+		float weight = bilinear[i] * exp(-difference / edgeSharpness);
+		sum += taps[i] * weight;
+		weightSum += weight;
 	}
-	col3 /= samples;
+	return sum / weightSum; // the nearest tap always has weight
+}
+
+void main(void) 
+{
+	vec3 col3 = renderSize == ivec2(outputSize) ? resolve(ivec2(gl_FragCoord.xy)) : upscale(gl_FragCoord.xy);
 	color = vec4(ACESFilm(col3), 1.0);
 	//color = vec4(col3, 1.0);
 }
\ No newline at end of file
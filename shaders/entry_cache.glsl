@@ -0,0 +1,63 @@
+#version 430
+#pragma include("common.glsl")
+
+// distance along every pixel's camera ray to the first content it can reach, or -1 if it can't reach any. A coarse 
+// mip of the bake is sampled with linear filtering, which spreads every occupied cell into its neighbours, and the
+// entry is pulled back by a cell, so no ray inside the pixel can find content before it
+layout(local_size_x = 16, local_size_y = 16) in;
+layout(binding = 1) uniform sampler3D bakedVolume;
+layout(r32f, binding = 0) writeonly uniform image2D entryTex;
+
+uniform mat4 view;
+uniform ivec2 renderSize;
+uniform vec3 lowerBound;
+uniform vec3 scaleFactor;
+uniform float level; // mip of the bake the cells come from
+uniform vec3 cellSize; // of that mip, in uvw
+
+const float farT = 5.0; // same as raymarch.glsl's
+
+// from Trevor Headstrom's code
+vec2 rayBox(vec3 ro, vec3 rd, vec3 mn, vec3 mx) {
+    vec3 id = 1 / rd;
+    vec3 t0 = (mn - ro) * id;
+    vec3 t1 = (mx - ro) * id;
+    vec3 tmin = min(t0, t1);
+    vec3 tmax = max(t0, t1);
+    return vec2(max(max(tmin.x, tmin.y), tmin.z), min(min(tmax.x, tmax.y), tmax.z));
+}
+
+void main()
+{
+    ivec2 screenIndex = ivec2(gl_GlobalInvocationID.xy);
+    if (any(greaterThanEqual(screenIndex, renderSize)))
+    {
+        return;
+    }
+
+    // the pixel's center ray, gen_rays.glsl jitters inside it
+    vec2 halfRes = vec2(renderSize) * 0.5;
+    vec2 clip = (vec2(screenIndex) + 0.5 - halfRes) / halfRes.y;
+    vec3 rd = (view * vec4(normalize(vec3(clip, focalLength)), 0.0)).xyz;
+    vec3 ro = (view * vec4(vec3(0.0), 1.0)).xyz;
+
+    vec2 isect = rayBox(ro, rd, lowerBound, -1.0 * lowerBound);
+    isect.x = max(0.0, isect.x);
+    isect.y = min(isect.y, farT);
+
+    // half cell steps in world units so no cell is stepped over
+    vec3 worldCell = cellSize / scaleFactor;
+    float dt = 0.5 * min(min(worldCell.x, worldCell.y), worldCell.z);
+    float entry = -1.0;
+    for (float t = isect.x; t < isect.y; t += dt)
+    {
+        vec3 uvw = (ro + rd * t - lowerBound) * scaleFactor;
+        if (textureLod(bakedVolume, uvw, level).a > 0.0)
+        {
+            entry = max(t - length(worldCell), isect.x);
+            break;
+        }
+    }
+
+    imageStore(entryTex, screenIndex, vec4(entry));
+}
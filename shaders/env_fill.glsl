@@ -0,0 +1,37 @@
+#version 430
+#pragma include("common.glsl")
+
+// gives every sample of the pixels outside the volume's screen rectangle the environment behind them once, when 
+// accumulation restarts. Nothing traces them after that
+layout(local_size_x = 16, local_size_y = 16) in;
+layout(rgba16f, binding = 0) writeonly uniform image2D imgOutput;
+layout(rgba16f, binding = 6) writeonly uniform image2D accumTex;
+layout(binding = 4) uniform samplerCube cubemap;
+
+uniform uint numSamples;
+uniform mat4 view;
+uniform mat3 envRotation;
+uniform ivec2 renderSize;
+uniform ivec2 screenRectMin;
+uniform ivec2 screenRectMax;
+
+void main()
+{
+    ivec2 screenIndex = ivec2(gl_GlobalInvocationID.xy);
+    if (any(greaterThanEqual(screenIndex, renderSize)) || (all(greaterThanEqual(screenIndex, screenRectMin)) && all(lessThan(screenIndex, screenRectMax))))
+    {
+        return;
+    }
+
+    vec2 halfRes = vec2(renderSize) * 0.5;
+    vec2 clip = (vec2(screenIndex) + 0.5 - halfRes) / halfRes.y;
+    vec3 rd = (view * vec4(normalize(vec3(clip, focalLength)), 0.0)).xyz;
+    vec4 env = vec4(texture(cubemap, envRotation * rd).rgb, 1.0);
+
+    for (uint s = 0; s < numSamples; s++)
+    {
+        ivec2 index = ivec2(screenIndex.x * int(numSamples) + int(s), screenIndex.y);
+        imageStore(imgOutput, index, env);
+        imageStore(accumTex, index, vec4(0.0));
+    }
+}
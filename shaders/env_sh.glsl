@@ -0,0 +1,62 @@
+#version 430
+
+#pragma include("common.glsl")
+#pragma include("sh.glsl")
+
+// projects the environment onto order 1 spherical harmonics in a single workgroup, every invocation integrates a
+// stratified share of the sphere and the shares are summed through shared memory
+layout(local_size_x = 256) in;
+layout(binding = 4) uniform samplerCube cubemap;
+layout(std430, binding = 2) writeonly buffer EnvSh { vec4 envSh[3]; }; // r, g, b coefficients
+
+uniform uint samplesPerInvocation;
+
+const int groupSize = 256;
+const float diffuseCubemapLod = 7.416f;
+
+shared vec4 sumR[groupSize];
+shared vec4 sumG[groupSize];
+shared vec4 sumB[groupSize];
+
+void main()
+{
+    int local = int(gl_LocalInvocationID.x);
+    initRNG(ivec2(local, 0), 0);
+
+    // the sphere is split into groupSize bands of z, each invocation jitters its samples inside its band
+    vec4 shR = vec4(0.0), shG = vec4(0.0), shB = vec4(0.0);
+    for (uint i = 0; i < samplesPerInvocation; i++)
+    {
+        vec2 u = vec2((float(local) + rand()) / float(groupSize), (float(i) + rand()) / float(samplesPerInvocation));
+        vec3 dir = uniformSphere(u);
+        vec3 radiance = textureLod(cubemap, dir, diffuseCubemapLod).rgb;
+        vec4 basis = shBasis(dir);
+        shR += radiance.r * basis;
+        shG += radiance.g * basis;
+        shB += radiance.b * basis;
+    }
+
+    sumR[local] = shR;
+    sumG[local] = shG;
+    sumB[local] = shB;
+
+    for (int stride = groupSize / 2; stride > 0; stride /= 2)
+    {
+        memoryBarrierShared();
+        barrier();
+        if (local < stride)
+        {
+            sumR[local] += sumR[local + stride];
+            sumG[local] += sumG[local + stride];
+            sumB[local] += sumB[local + stride];
+        }
+    }
+
+    if (local == 0)
+    {
+        float weight = 4.0 * pi / float(groupSize * samplesPerInvocation);
+        envSh[0] = sumR[0] * weight;
+        envSh[1] = sumG[0] * weight;
+        envSh[2] = sumB[0] * weight;
+    }
+}
@@ -0,0 +1,146 @@
+#version 430
+#pragma include("common.glsl")
+#pragma include("temporal.glsl")
+
+// the first hit of every pixel's center ray for temporal reuse, and where the previous view saw the same hit. Samples
+// scatter at random along their rays, so instead of any one of their hits the pixel keeps the median of them: the
+// depth where the optical depth through the bake first reaches ln 2, or where it crosses the surface threshold if
+// that comes first. Marched at fixed steps with a fixed origin, that depth only moves when the view or the volume does
+layout(local_size_x = 16, local_size_y = 16) in;
+layout(binding = 1) uniform sampler3D bakedVolume;
+layout(binding = 2) uniform usampler2D historyGBuffer; // first hits of the view the history was accumulated in
+layout(rgba32ui, binding = 0) writeonly uniform uimage2D gbufferTex;
+layout(rgba32f, binding = 1) writeonly uniform image2D reprojectTex; // previous pixel in xy, confidence in z
+
+uniform mat4 view;
+uniform ivec2 renderSize;
+uniform vec3 lowerBound;
+uniform vec3 scaleFactor;
+uniform vec3 bakeResolution;
+uniform uint reproject;
+uniform mat4 prevInvView; // world to the previous view's camera space
+uniform ivec2 prevRenderSize;
+
+const float farT = 5.0; // same as raymarch.glsl's
+const float densityScale = 0.005; // same as raymarch.glsl's
+const float surfaceThresh = 0.7f; // same as raymarch.glsl's
+
+const float reprojectTolerance = 4.0; // steps a first hit can move by and still be the same surface
+
+// from Trevor Headstrom's code
+vec2 rayBox(vec3 ro, vec3 rd, vec3 mn, vec3 mx) {
+    vec3 id = 1 / rd;
+    vec3 t0 = (mn - ro) * id;
+    vec3 t1 = (mx - ro) * id;
+    vec3 tmin = min(t0, t1);
+    vec3 tmax = max(t0, t1);
+    return vec2(max(max(tmin.x, tmin.y), tmin.z), min(min(tmax.x, tmax.y), tmax.z));
+}
+
+vec3 bakeGradient(vec3 uvw)
+{
+    vec3 highVals = vec3(
+        textureLodOffset(bakedVolume, uvw, 0.0, ivec3(1, 0, 0)).a,
+        textureLodOffset(bakedVolume, uvw, 0.0, ivec3(0, 1, 0)).a,
+        textureLodOffset(bakedVolume, uvw, 0.0, ivec3(0, 0, 1)).a
+    );
+
+    vec3 lowVals = vec3(
+        textureLodOffset(bakedVolume, uvw, 0.0, ivec3(-1, 0, 0)).a,
+        textureLodOffset(bakedVolume, uvw, 0.0, ivec3(0, -1, 0)).a,
+        textureLodOffset(bakedVolume, uvw, 0.0, ivec3(0, 0, -1)).a
+    );
+
+    return lowVals - highVals;
+}
+
+void main()
+{
+    ivec2 screenIndex = ivec2(gl_GlobalInvocationID.xy);
+    if (any(greaterThanEqual(screenIndex, renderSize)))
+    {
+        return;
+    }
+
+    // the pixel's center ray, gen_rays.glsl jitters inside it
+    vec2 halfRes = vec2(renderSize) * 0.5;
+    vec2 clip = (vec2(screenIndex) + 0.5 - halfRes) / halfRes.y;
+    vec3 rd = (view * vec4(normalize(vec3(clip, focalLength)), 0.0)).xyz;
+    vec3 ro = (view * vec4(vec3(0.0), 1.0)).xyz;
+
+    vec2 isect = rayBox(ro, rd, lowerBound, -1.0 * lowerBound);
+    isect.x = max(0.0, isect.x);
+    isect.y = min(isect.y, farT);
+
+    // half bake voxel steps in world units
+    vec3 worldVoxel = 1.0 / (bakeResolution * scaleFactor);
+    float dt = 0.5 * min(min(worldVoxel.x, worldVoxel.y), worldVoxel.z);
+    const float medianDepth = densityScale * log(2.0);
+
+    float opticalDepth = 0.0;
+    bool hit = false;
+    vec3 uvw = vec3(0.0);
+    for (float t = isect.x; t < isect.y; t += dt)
+    {
+        uvw = (ro + rd * t - lowerBound) * scaleFactor;
+        float sigmaT = textureLod(bakedVolume, uvw, 0.0).a;
+        if (sigmaT > surfaceThresh)
+        {
+            hit = true;
+            break;
+        }
+
+        if (opticalDepth + sigmaT * dt >= medianDepth)
+        {
+            // where inside the step the optical depth reaches the median
+            uvw = (ro + rd * (t + (medianDepth - opticalDepth) / sigmaT) - lowerBound) * scaleFactor;
+            hit = true;
+            break;
+        }
+        opticalDepth += sigmaT * dt;
+    }
+
+    if (!hit)
+    {
+        imageStore(gbufferTex, screenIndex, uvec4(gbufferMiss));
+        imageStore(reprojectTex, screenIndex, vec4(0.0));
+        return;
+    }
+
+    vec3 grad = bakeGradient(uvw);
+    bool hasNormal = length(grad) > 1e-3;
+    vec3 n = hasNormal ? normalize(grad) : vec3(0.0);
+    imageStore(gbufferTex, screenIndex, packGBuffer(uvw, hasNormal, n));
+
+    if (reproject == 0)
+    {
+        return;
+    }
+
+    // the pixel the previous view saw this hit in, and how likely it saw the same surface there. That's 0 where the
+    // hit was disoccluded or is too far from the previous hit, and less than 1 the less alike the two hits are
+    float confidence = 0.0;
+    vec3 cam = (prevInvView * vec4(uvw / scaleFactor + lowerBound, 1.0)).xyz;
+    vec2 prevHalfRes = vec2(prevRenderSize) * 0.5;
+    vec2 prevScreen = floor(cam.xy / cam.z * focalLength * prevHalfRes.y + prevHalfRes);
+    if (cam.z > 0.0 && all(greaterThanEqual(prevScreen, vec2(0.0))) && all(lessThan(prevScreen, vec2(prevRenderSize))))
+    {
+        uvec4 prevHit = texelFetch(historyGBuffer, ivec2(prevScreen), 0);
+        if (prevHit.x != gbufferMiss)
+        {
+            float distance = length((uintBitsToFloat(prevHit.xyz) - uvw) / scaleFactor);
+            confidence = clamp(1.0 - distance / (reprojectTolerance * dt), 0.0, 1.0);
+
+            if (hasNormal && (prevHit.w & gbufferHasNormal) != 0u)
+            {
+                confidence *= smoothstep(0.8, 0.95, dot(n, unpackGBufferNormal(prevHit.w)));
+            }
+
+            // a smaller previous render covers several of this one's pixels with each of its samples
+            vec2 scaleRatio = min(vec2(prevRenderSize) / vec2(renderSize), vec2(1.0));
+            confidence *= scaleRatio.x * scaleRatio.y;
+        }
+    }
+
+    imageStore(reprojectTex, screenIndex, vec4(prevScreen, confidence, 0.0));
+}
@@ -1,42 +1,106 @@
 #version 430
 #pragma include("common.glsl")
+#pragma include("queue.glsl")
+#pragma include("tiles.glsl")
 
 layout(local_size_x = 16, local_size_y = 16) in;
 layout(rgba16f, binding = 0) uniform image2D imgOutput;
 layout(rgba16f, binding = 5) uniform image2D rayPosTex;
 layout(rgba16f, binding = 6) uniform image2D accumTex;
+layout(binding = 4) uniform samplerCube cubemap; // for the rays finished here
+layout(std430, binding = 3) buffer TraceQueue { uvec3 traceArgs; uint traceCount; uint traceItems[]; };
 uniform uint numSamples;
 uniform mat4 view;
 uniform int itrs;
+uniform uint wavefront; // rays that miss the volume's box are finished here instead of being queued for the trace
+uniform vec3 lowerBound;
+uniform mat3 envRotation;
+layout(std430, binding = 5) readonly buffer TileQueue { uvec3 tileArgs; uint tileCount; uint tileItems[]; };
+uniform uint adaptive; // dispatched over the tile list of adaptive sampling
+uniform uint activeSamples; // samples per pixel the quality governor lets an iteration take, at most numSamples
+uniform ivec2 renderSize; // pixels rendered at the current render scale, the top left of the ray textures
+uniform ivec2 screenRectMin; // the volume's box projects inside [screenRectMin, screenRectMax), full screen dispatches 
+uniform ivec2 screenRectMax; // only cover that and env_fill.glsl gave the pixels outside it the environment
+layout(r32f, binding = 3) readonly uniform image2D entryTex; // see entry_cache.glsl
+uniform uint entryCache;
 
-const vec2 screenRes = vec2(1920.0, 1080.0); // todo: make uniform
-//const vec2 screenRes = vec2(3840.0, 2160.0);
-const vec2 halfRes = screenRes * 0.5;
-const float z = 1.0 / tan(radians(45.0) * 0.5);
+const float farT = 5.0;
+
+// from Trevor Headstrom's code
+vec2 rayBox(vec3 ro, vec3 rd, vec3 mn, vec3 mx) {
+    vec3 id = 1 / rd;
+    vec3 t0 = (mn - ro) * id;
+    vec3 t1 = (mx - ro) * id;
+    vec3 tmin = min(t0, t1);
+    vec3 tmax = max(t0, t1);
+    return vec2(max(max(tmin.x, tmin.y), tmin.z), min(min(tmax.x, tmax.y), tmax.z));
+}
 
 void main()
 {
-    // get index in global work group i.e x,y position
+    // get index in global work group i.e x,y position, or in the listed tile with adaptive sampling
     ivec2 index = ivec2(gl_GlobalInvocationID.xy);
+    if (adaptive == 1)
+    {
+        if (!tilePixel(tileItems[gl_WorkGroupID.x / numSamples], numSamples, activeSamples, itrs, index))
+        {
+            return;
+        }
+    }
+    else
+    {
+        index = activeSampleIndex(index, numSamples, activeSamples) + ivec2(screenRectMin.x * int(numSamples), screenRectMin.y);
+    }
     ivec2 screenIndex = ivec2(index.x / numSamples, index.y);
+    if (any(lessThan(screenIndex, screenRectMin)) || any(greaterThanEqual(screenIndex, screenRectMax)))
+    {
+        return;
+    }
 
     // TODO: seed better
     initRNG(index, itrs);
 
+    vec2 halfRes = vec2(renderSize) * 0.5;
     vec2 clip = (vec2(screenIndex.xy + rand2()) - halfRes) / halfRes.y;
-    vec3 rd = (view * vec4(normalize(vec3(clip, z)), 0.0)).xyz;
+    vec3 rd = (view * vec4(normalize(vec3(clip, focalLength)), 0.0)).xyz;
     vec3 ro = (view * vec4(vec3(0.0), 1.0)).xyz;
 
     float phiOff = rd.x < 0.0 ? pi : 0.0;
     vec4 rayPosPk = vec4(ro, acos(rd.z)); // xyz-theta
     vec4 accumPk = vec4(vec3(1.0), phiOff + atan(rd.y / rd.x)); // rgb-phi
 
+    // pixels that can't reach any content keep the environment they got on the first iteration, nothing after 
+    // this pass touches them since their paths are already over
+    if (entryCache == 1 && imageLoad(entryTex, screenIndex).r < 0.0)
+    {
+        if (itrs == 1)
+        {
+            imageStore(imgOutput, index, vec4(texture(cubemap, envRotation * rd).rgb, 1.0));
+            imageStore(accumTex, index, vec4(0.0));
+        }
+        return;
+    }
+
     if(itrs == 1)
     {
         vec4 lastImgVal = imageLoad(imgOutput, index);
         imageStore(imgOutput, index, vec4(lastImgVal.rgb, 1.0)); 
     }
 
+    if (wavefront == 1)
+    {
+        // same early out as raymarch.glsl's
+        vec2 isect = rayBox(ro, rd, lowerBound, -1.0 * lowerBound);
+        if (max(0.0, isect.x) >= min(isect.y, farT))
+        {
+            imageStore(imgOutput, index, vec4(texture(cubemap, envRotation * rd).rgb, 1.0));
+            imageStore(accumTex, index, vec4(0.0));
+            return;
+        }
+
+        traceItems[atomicAdd(traceCount, 1u)] = packPixel(index);
+    }
+
     imageStore(rayPosTex, index, rayPosPk);
     imageStore(accumTex, index, accumPk);
 }
\ No newline at end of file
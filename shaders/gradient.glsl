@@ -0,0 +1,63 @@
+#version 430
+#pragma include("gradient_encoding.glsl")
+
+layout(local_size_x = 8, local_size_y = 8, local_size_z = 8) in;
+layout(binding = 1) uniform sampler3D rawVolume;
+layout(binding = 4) writeonly uniform image3D gradientVolume;
+
+uniform ivec3 scanResolution;
+uniform uint kernel;
+
+const uint centralKernel = 1;
+const uint sobelKernel = 2;
+
+// same as sampling outside the volume with the border color
+float density(ivec3 p)
+{
+    if (any(lessThan(p, ivec3(0))) || any(greaterThanEqual(p, scanResolution)))
+    {
+        return 0.0;
+    }
+
+    return texelFetch(rawVolume, p, 0).r;
+}
+
+// Stores the (low - high) density gradient raymarch.glsl's calcGradient would compute at every voxel as a quantized
+// normal and magnitude, see gradient_encoding.glsl. A flat region stores a magnitude of exactly 0.
+void main()
+{
+    ivec3 index = ivec3(gl_GlobalInvocationID.xyz);
+    if (any(greaterThanEqual(index, scanResolution)))
+    {
+        return;
+    }
+
+    vec3 grad = vec3(0.0);
+    if (kernel == sobelKernel)
+    {
+        // 3x3x3 sobel, derivative along each axis smoothed with a [1 2 1] x [1 2 1] kernel across the other two
+        for (int z = -1; z <= 1; z++)
+        {
+            for (int y = -1; y <= 1; y++)
+            {
+                for (int x = -1; x <= 1; x++)
+                {
+                    ivec3 offset = ivec3(x, y, z);
+                    vec3 smoothing = vec3(2.0) - vec3(abs(offset));
+                    vec3 weights = vec3(smoothing.y * smoothing.z, smoothing.x * smoothing.z, smoothing.x * smoothing.y) * -vec3(offset);
+                    grad += weights * density(index + offset);
+                }
+            }
+        }
+
+        grad /= 16.0;
+    }
+    else
+    {
+        vec3 highVals = vec3(density(index + ivec3(1, 0, 0)), density(index + ivec3(0, 1, 0)), density(index + ivec3(0, 0, 1)));
+        vec3 lowVals = vec3(density(index - ivec3(1, 0, 0)), density(index - ivec3(0, 1, 0)), density(index - ivec3(0, 0, 1)));
+        grad = lowVals - highVals;
+    }
+
+    imageStore(gradientVolume, index, encodeGradient(grad));
+}
@@ -0,0 +1,35 @@
+// how gradient.glsl stores a gradient in an unsigned rgba texel: the direction octahedrally mapped to rg and the
+// magnitude in b, square rooted so the small gradients of soft tissue keep their precision. Trilinear filtering of
+// the texels is close enough except across the octahedron's folds, where neighbouring directions are far apart in rg
+
+const float maxGradient = 1.7320508; // a density step of 1 along every axis, neither kernel goes past it
+
+vec2 signNotZero(vec2 v)
+{
+    return vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+vec4 encodeGradient(vec3 grad)
+{
+    float magnitude = length(grad);
+    if (magnitude == 0.0)
+    {
+        return vec4(0.5, 0.5, 0.0, 1.0);
+    }
+
+    vec3 n = grad / (abs(grad.x) + abs(grad.y) + abs(grad.z));
+    vec2 oct = n.z >= 0.0 ? n.xy : (1.0 - abs(n.yx)) * signNotZero(n.xy);
+    return vec4(oct * 0.5 + 0.5, sqrt(min(magnitude / maxGradient, 1.0)), 1.0);
+}
+
+// a zero vector where the stored magnitude is 0
+vec3 decodeGradient(vec4 texel)
+{
+    vec2 oct = texel.rg * 2.0 - 1.0;
+    vec3 n = vec3(oct, 1.0 - abs(oct.x) - abs(oct.y));
+    if (n.z < 0.0)
+    {
+        n.xy = (1.0 - abs(n.yx)) * signNotZero(n.xy);
+    }
+    return normalize(n) * texel.b * texel.b * maxGradient;
+}
@@ -0,0 +1,53 @@
+#version 430
+
+#pragma include("common.glsl")
+#pragma include("cone.glsl")
+
+// transmittance from every voxel to each of up to 4 lights, one light per channel. Shading reads one texel instead
+// of marching a shadow ray per light
+layout(local_size_x = 4, local_size_y = 4, local_size_z = 4) in;
+layout(binding = 3) uniform sampler3D sigmaVolume;
+layout(binding = 1) writeonly uniform image3D lightVolume;
+
+uniform ivec3 lightResolution;
+uniform vec4 lightPositions[4]; // w = 0: xyz is the direction towards a directional light, w = 1: a point light's position
+uniform int numLights;
+uniform float bakeLevel; // mip of the bake about as coarse as the light volume
+
+// same extinction scale as the direct pass's cones
+const float extinctionScale = 10.0;
+
+float transmittance(vec3 p, vec4 light)
+{
+    vec3 toLight = light.w == 0.0 ? light.xyz : light.xyz - p;
+    vec3 dir = normalize(toLight);
+    float tEnd = light.w == 0.0 ? unitBoxExit(p, dir) : min(unitBoxExit(p, dir), length(toLight));
+
+    // steps of one light volume voxel, half a step in so the voxel itself doesn't shadow it
+    float dt = 1.0 / float(max(max(lightResolution.x, lightResolution.y), lightResolution.z));
+    float opticalDepth = 0.0;
+    for (float t = dt * 0.5; t < tEnd; t += dt)
+    {
+        vec4 bakedVal = textureLod(sigmaVolume, p + t * dir, bakeLevel);
+        opticalDepth += pow(bakedVal.a, 1.5) * dot(vec3(1.0) - bakedVal.rgb, vec3(1.0 / 3.0)) * dt;
+    }
+    return exp(-opticalDepth * extinctionScale);
+}
+
+void main()
+{
+    ivec3 index = ivec3(gl_GlobalInvocationID.xyz);
+    if (any(greaterThanEqual(index, lightResolution)))
+    {
+        return;
+    }
+
+    vec3 p = (vec3(index) + 0.5) / vec3(lightResolution);
+    vec4 result = vec4(1.0);
+    for (int i = 0; i < numLights; i++)
+    {
+        result[i] = transmittance(p, lightPositions[i]);
+    }
+
+    imageStore(lightVolume, index, result);
+}
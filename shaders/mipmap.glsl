@@ -0,0 +1,95 @@
+#version 430
+
+// builds up to 3 mip levels of the baked volume per dispatch, each workgroup reduces an 8^3 block of the source
+// level into 4^3, 2^3 and 1 voxels of the next levels through shared memory
+layout(local_size_x = 8, local_size_y = 8, local_size_z = 8) in;
+layout(rgba16, binding = 1) readonly uniform image3D srcLevel;
+layout(binding = 2) writeonly uniform image3D dstLevel1;
+layout(binding = 3) writeonly uniform image3D dstLevel2;
+layout(binding = 4) writeonly uniform image3D dstLevel3;
+
+uniform ivec3 srcResolution;
+uniform int numLevels; // how many of the 3 destination levels exist
+uniform uint reduction;
+
+const uint extinctionAverage = 0; // averages the per channel extinction opacity^1.5 * (1 - rgb) the cone tracer sees
+const uint maxOpacity = 1; // keeps the densest child so thin features still occlude at coarse levels
+const uint opacityWeighted = 2; // averages sigma, with color weighted by each child's opacity
+
+const int groupSize = 8;
+
+// (color * weight, weight) and the reduced extinction or opacity of each voxel
+shared vec4 colorCache[groupSize * groupSize * groupSize];
+shared float valueCache[groupSize * groupSize * groupSize];
+
+int cacheIndex(ivec3 p)
+{
+    return (p.z * groupSize + p.y) * groupSize + p.x;
+}
+
+void store(int level, ivec3 p, vec4 color, float value)
+{
+    vec3 rgb = color.a > 0.0 ? color.rgb / color.a : vec3(0.0);
+    float opacity = reduction == maxOpacity ? value : pow(value, 1.0 / 1.5);
+    vec4 texel = vec4(rgb, opacity);
+
+    ivec3 dstResolution = max(srcResolution >> level, ivec3(1));
+    if (level > numLevels || any(greaterThanEqual(p, dstResolution)))
+    {
+        return;
+    }
+
+    if (level == 1)
+    {
+        imageStore(dstLevel1, p, texel);
+    }
+    else if (level == 2)
+    {
+        imageStore(dstLevel2, p, texel);
+    }
+    else
+    {
+        imageStore(dstLevel3, p, texel);
+    }
+}
+
+void main()
+{
+    ivec3 local = ivec3(gl_LocalInvocationID);
+
+    // odd sized levels drop their last voxel like the driver's box filter, reads past the edge repeat it
+    ivec3 src = min(ivec3(gl_WorkGroupID) * groupSize + local, srcResolution - 1);
+    vec4 texel = imageLoad(srcLevel, src);
+
+    // averaging sigma * (1 - rgb) per channel and sigma itself, then taking rgb back out as 1 - average / sigma, comes
+    // down to averaging color weighted by sigma
+    float weight = reduction == extinctionAverage ? pow(texel.a, 1.5) : (reduction == opacityWeighted ? texel.a : 1.0);
+    colorCache[cacheIndex(local)] = vec4(texel.rgb * weight, weight);
+    valueCache[cacheIndex(local)] = reduction == maxOpacity ? texel.a : pow(texel.a, 1.5);
+
+    // each step halves the block, the result of a parent is written over its first child which only it reads
+    for (int level = 1; level <= 3; level++)
+    {
+        memoryBarrierShared();
+        barrier();
+
+        int activeSize = groupSize >> level;
+        if (all(lessThan(local, ivec3(activeSize))))
+        {
+            int stride = 1 << (level - 1);
+            vec4 color = vec4(0.0);
+            float value = 0.0;
+            for (int i = 0; i < 8; i++)
+            {
+                ivec3 child = (local * 2 + ivec3(i & 1, (i >> 1) & 1, i >> 2)) * stride;
+                color += colorCache[cacheIndex(child)];
+                float childValue = valueCache[cacheIndex(child)];
+                value = reduction == maxOpacity ? max(value, childValue) : value + childValue * 0.125;
+            }
+
+            colorCache[cacheIndex(local * 2 * stride)] = color;
+            valueCache[cacheIndex(local * 2 * stride)] = value;
+            store(level, ivec3(gl_WorkGroupID) * activeSize + local, color, value);
+        }
+    }
+}
@@ -0,0 +1,53 @@
+#version 430
+
+// directional opacity (x, y, z) of the baked volume's mips for anisotropic cone tracing. Opacity composites the
+// same front to back and back to front, so the +/- faces of each axis are equal and one texel holds all six
+layout(local_size_x = 4, local_size_y = 4, local_size_z = 4) in;
+layout(rgba16, binding = 1) readonly uniform image3D srcLevel;
+layout(binding = 2) writeonly uniform image3D dstLevel;
+
+uniform ivec3 srcResolution;
+uniform ivec3 dstResolution;
+uniform uint fromBake; // the first level is copied from the isotropic bake's opacity
+
+// opacity of one child's length that, composited twice, gives the opacity of the pair, keeps the value meaning the
+// same thing at every level so the cone tracer can keep scaling it by its step
+float composite(float front, float back)
+{
+    return 1.0 - sqrt((1.0 - front) * (1.0 - back));
+}
+
+void main()
+{
+    ivec3 index = ivec3(gl_GlobalInvocationID.xyz);
+    if (any(greaterThanEqual(index, dstResolution)))
+    {
+        return;
+    }
+
+    if (fromBake == 1)
+    {
+        imageStore(dstLevel, index, vec4(vec3(imageLoad(srcLevel, index).a), 1.0));
+        return;
+    }
+
+    vec3 children[8];
+    for (int i = 0; i < 8; i++)
+    {
+        ivec3 child = min(index * 2 + ivec3(i & 1, (i >> 1) & 1, i >> 2), srcResolution - 1);
+        children[i] = imageLoad(srcLevel, child).xyz;
+    }
+
+    // each axis composites the 4 rows of 2 children running along it and averages the rows
+    vec3 opacity = vec3(0.0);
+    for (int row = 0; row < 4; row++)
+    {
+        int a = row & 1;
+        int b = row >> 1;
+        opacity.x += composite(children[(b * 2 + a) * 2].x, children[(b * 2 + a) * 2 + 1].x);
+        opacity.y += composite(children[b * 4 + a].y, children[b * 4 + 2 + a].y);
+        opacity.z += composite(children[b * 2 + a].z, children[4 + b * 2 + a].z);
+    }
+
+    imageStore(dstLevel, index, vec4(opacity * 0.25, 1.0));
+}
@@ -0,0 +1,19 @@
+// multiple scattering gain of multiscatter_lut.glsl's table: energy leaving a homogeneous sphere after any number of
+// scattering events over the energy leaving it after exactly one, by single scatter albedo (x) and the sphere's
+// optical radius (y, stored as sqrt(radius / msMaxOpticalRadius)). r is the isotropic phase, g the lambertian surface
+
+const float msMaxOpticalRadius = 4.0;
+
+vec3 multipleScatteringGain(sampler2D msLUT, vec3 albedo, float opticalRadius, bool surface)
+{
+    // texels hold the table's end points so albedo 0 and 1 are exact
+    vec2 size = vec2(textureSize(msLUT, 0));
+    float v = sqrt(clamp(opticalRadius / msMaxOpticalRadius, 0.0, 1.0));
+    vec3 x = (clamp(albedo, vec3(0.0), vec3(1.0)) * (size.x - 1.0) + 0.5) / size.x;
+    float y = (v * (size.y - 1.0) + 0.5) / size.y;
+
+    vec2 r = texture(msLUT, vec2(x.r, y)).rg;
+    vec2 g = texture(msLUT, vec2(x.g, y)).rg;
+    vec2 b = texture(msLUT, vec2(x.b, y)).rg;
+    return surface ? vec3(r.g, g.g, b.g) : vec3(r.r, g.r, b.r);
+}
@@ -0,0 +1,76 @@
+#version 430
+
+#pragma include("common.glsl")
+#pragma include("materials.glsl")
+#pragma include("multiscatter.glsl")
+
+// random walks out of a homogeneous sphere from its center, which the shading point stands in for. Every walk
+// starts right after the first scattering event, so leaving without another one is the single scattering the 
+// direct pass already computes and the rest is what extra bounces would add
+layout(local_size_x = 8, local_size_y = 8) in;
+layout(rg16f, binding = 1) writeonly uniform image2D msLUT;
+
+uniform ivec2 lutResolution;
+uniform uint numWalks;
+
+const int maxBounces = 64;
+
+// distance to the sphere of radius r around the origin, p is inside it
+float sphereExit(vec3 p, vec3 d, float r)
+{
+    float b = dot(p, d);
+    return -b + sqrt(max(b * b - dot(p, p) + r * r, 0.0));
+}
+
+// direction after scattering off a lambertian surface of random orientation facing the incoming ray
+vec3 sampleSurface(vec3 d)
+{
+    vec3 n = sampleLambertian(-d, rand2());
+    return sampleLambertian(n, rand2());
+}
+
+float walk(float albedo, float radius, bool surface)
+{
+    vec3 p = vec3(0.0);
+    vec3 d = surface ? sampleSurface(vec3(0.0, 0.0, 1.0)) : sampleSchlickPhase(vec3(0.0, 0.0, 1.0), rand2());
+    float weight = 1.0;
+    for (int i = 0; i < maxBounces; i++)
+    {
+        float s = -log(max(1.0 - rand(), 1e-7));
+        float tExit = sphereExit(p, d, radius);
+        if (s >= tExit)
+        {
+            return weight;
+        }
+
+        p += s * d;
+        weight *= albedo;
+        d = surface ? sampleSurface(d) : sampleSchlickPhase(d, rand2());
+    }
+    return 0.0;
+}
+
+void main()
+{
+    ivec2 index = ivec2(gl_GlobalInvocationID.xy);
+    if (any(greaterThanEqual(index, lutResolution)))
+    {
+        return;
+    }
+
+    initRNG(index, 1u);
+
+    vec2 uv = vec2(index) / vec2(lutResolution - 1);
+    float albedo = uv.x;
+    float radius = uv.y * uv.y * msMaxOpticalRadius;
+
+    vec2 escaped = vec2(0.0);
+    for (uint i = 0; i < numWalks; i++)
+    {
+        escaped += vec2(walk(albedo, radius, false), walk(albedo, radius, true));
+    }
+
+    // a walk leaves without scattering again with probability exp(-radius)
+    vec2 gain = escaped / (float(numWalks) * exp(-radius));
+    imageStore(msLUT, index, vec4(max(gain, vec2(1.0)), 0.0, 0.0));
+}
@@ -0,0 +1,21 @@
+// persistent threads: instead of one invocation per ray, a fixed number of workgroups loop over the rays of the pass.
+// Every lane takes its next ray from a global counter as soon as its current one is done marching, in between march
+// steps, so a lane whose ray missed goes on with another instead of idling until the longest ray of its warp is done.
+// Rays are numbered the way the regular dispatch would have run them, ray / queueGroupSize is the workgroup and
+// ray % queueGroupSize the invocation inside it, so lanes taking rays together march neighbouring pixels. Needs queue.glsl
+
+layout(std430, binding = 6) coherent buffer RayScheduler
+{
+    uint nextRay; // first ray no lane has taken yet
+    uint laneSteps[4]; // (lo, hi) of the steps the lanes marched, then of the steps their workgroups were resident for
+};
+
+// laneSteps[i] and laneSteps[i + 1] as one 64 bit count, the steps of an iteration don't fit 32 bits
+void addLaneSteps(uint i, uint steps)
+{
+    uint old = atomicAdd(laneSteps[i], steps);
+    if (old + steps < old)
+    {
+        atomicAdd(laneSteps[i + 1], 1u);
+    }
+}
@@ -1,40 +1,100 @@
 #version 430
 
-layout(local_size_x = 8, local_size_y = 8, local_size_z = 8) in;
+layout(local_size_x = 16, local_size_y = 16, local_size_z = 1) in;
 layout(r16, binding = 1) readonly uniform image3D rawVolume;
 layout(binding = 2) uniform sampler1D transferLUT;
 layout(binding = 3) uniform sampler1D opacityLUT;
 layout(binding = 4) writeonly uniform image3D bakedVolume;
 
 uniform ivec3 scanResolution;
+uniform ivec3 bakeResolution;
+uniform int sliceOffset; // re-bakes run a slab of slices per frame
 
-const ivec3 bakeResolution = ivec3(128);
+// each workgroup bakes a tileSize x tileSize x 1 tile of the baked volume
+const int tileSize = 16;
+const int cacheSize = 2048;
+
+// classified scan voxels (rgb transfer lut color, transfer lut opacity) of the part of the tile's footprint 
+// currently loaded, packed as halfs to keep the cache at 16KB
+shared uvec2 cache[cacheSize];
+
+// the bake doesn't have to divide the scan evenly, so each baked voxel covers the scan voxels whose index maps into it
+ivec3 footprintStart(ivec3 bakeIndex)
+{
+    return (bakeIndex * scanResolution) / bakeResolution;
+}
+
+ivec3 footprintEnd(ivec3 bakeIndex)
+{
+    return min(max(((bakeIndex + 1) * scanResolution) / bakeResolution, footprintStart(bakeIndex) + 1), scanResolution);
+}
 
 void main()
 {
-	ivec3 index = ivec3(gl_GlobalInvocationID.xyz);
+    ivec3 index = ivec3(gl_GlobalInvocationID.xyz) + ivec3(0, 0, sliceOffset);
+    bool inBake = all(lessThan(index, bakeResolution));
+
+    const ivec3 start = footprintStart(index);
+    const ivec3 end = footprintEnd(index);
+
+    // footprint of the whole tile, the tile can hang over the edge of the bake
+    const ivec3 tileFirst = ivec3(gl_WorkGroupID.xy * tileSize, index.z);
+    const ivec3 tileLast = min(tileFirst + ivec3(tileSize - 1, tileSize - 1, 0), bakeResolution - 1);
+    const ivec3 tileStart = footprintStart(tileFirst);
+    const ivec3 tileEnd = footprintEnd(tileLast);
 
-    const ivec3 itrRange = max(scanResolution / bakeResolution, 1);
-    const ivec3 itrStart = index * itrRange;
-    const ivec3 itrEnd = min(itrStart + itrRange, scanResolution);
+    // load the footprint chunk by chunk, as many whole rows as fit in the cache
+    const int chunkWidth = min(tileEnd.x - tileStart.x, cacheSize);
+    const int chunkHeight = cacheSize / chunkWidth;
 
-    ivec3 itr = itrStart;
-    vec4 avgCol = vec4(0.f);
-    for (; itr.z < itrEnd.z; itr.z++)
+    vec4 sum = vec4(0.0);
+    for (int z = tileStart.z; z < tileEnd.z; z++)
     {
-        for (; itr.y < itrEnd.y; itr.y++)
+        for (int chunkY = tileStart.y; chunkY < tileEnd.y; chunkY += chunkHeight)
         {
-            for (; itr.x < itrEnd.x; itr.x++)
+            for (int chunkX = tileStart.x; chunkX < tileEnd.x; chunkX += chunkWidth)
             {
-                float density = imageLoad(rawVolume, itr).r;
-                float opacity = texture(opacityLUT, density).r;
-                vec3 color = texture(transferLUT, density).rgb;
-                avgCol += vec4(color, opacity);
+                const ivec2 chunkDim = min(ivec2(chunkWidth, chunkHeight), tileEnd.xy - ivec2(chunkX, chunkY));
+
+                // every scan voxel is loaded and run through the luts by exactly one invocation, consecutive 
+                // invocations read consecutive voxels of a row
+                for (int i = int(gl_LocalInvocationIndex); i < chunkDim.x * chunkDim.y; i += tileSize * tileSize)
+                {
+                    ivec3 p = ivec3(chunkX + i % chunkDim.x, chunkY + i / chunkDim.x, z);
+                    float density = imageLoad(rawVolume, p).r;
+                    vec3 color = texture(transferLUT, density).rgb;
+                    float opacity = texture(opacityLUT, density).r;
+                    cache[i] = uvec2(packHalf2x16(color.rg), packHalf2x16(vec2(color.b, opacity)));
+                }
+
+                memoryBarrierShared();
+                barrier();
+
+                // then every invocation sums the part of its own footprint inside the chunk in parallel
+                if (inBake)
+                {
+                    const ivec2 sumStart = max(start.xy, ivec2(chunkX, chunkY));
+                    const ivec2 sumEnd = min(end.xy, ivec2(chunkX, chunkY) + chunkDim);
+                    for (int y = sumStart.y; y < sumEnd.y; y++)
+                    {
+                        for (int x = sumStart.x; x < sumEnd.x; x++)
+                        {
+                            uvec2 packed = cache[(y - chunkY) * chunkDim.x + (x - chunkX)];
+                            sum += vec4(unpackHalf2x16(packed.x), unpackHalf2x16(packed.y));
+                        }
+                    }
+                }
+
+                barrier();
             }
         }
     }
 
-    avgCol /= float(itrRange.x * itrRange.y * itrRange.z);
+    if (!inBake)
+    {
+        return;
+    }
 
-    imageStore(bakedVolume, index, avgCol);
-}
\ No newline at end of file
+    const ivec3 itrRange = end - start;
+    imageStore(bakedVolume, index, sum / float(itrRange.x * itrRange.y * itrRange.z));
+}
@@ -0,0 +1,38 @@
+#version 430
+
+layout(local_size_x = 16, local_size_y = 16) in;
+layout(binding = 3) uniform sampler1D opacityLUT;
+layout(rg32f, binding = 0) writeonly uniform image2D table;
+
+uniform int tableSize;
+
+// Pre-integrated opacity table indexed by the (front, back) density of a march step, see Engel et al. 2001
+// "High-Quality Pre-Integrated Volume Rendering Using Hardware-Accelerated Pixel Shading"
+// r: average opacity over the densities between front and back, the extinction of the whole slab
+// g: highest opacity between front and back, so surfaces inside a slab aren't stepped over
+void main()
+{
+    ivec2 index = ivec2(gl_GlobalInvocationID.xy);
+    if (any(greaterThanEqual(index, ivec2(tableSize))))
+    {
+        return;
+    }
+
+    // texel centers line up with how the 1d lut is sampled so looking up (d, d) is the same as a point sample
+    vec2 densities = (vec2(index) + 0.5) / float(tableSize);
+
+    // integrate at twice the lut's resolution so no stop gets skipped
+    const float lutSize = float(textureSize(opacityLUT, 0));
+    const int n = max(1, int(ceil(abs(densities.y - densities.x) * lutSize * 2.0)));
+
+    float integral = 0.0;
+    float maxOpacity = 0.0;
+    for (int i = 0; i <= n; i++)
+    {
+        float opacity = texture(opacityLUT, mix(densities.x, densities.y, float(i) / float(n))).r;
+        integral += (i == 0 || i == n) ? opacity * 0.5 : opacity; // trapezoid rule
+        maxOpacity = max(maxOpacity, opacity);
+    }
+
+    imageStore(table, index, vec4(integral / float(n), maxOpacity, 0.0, 0.0));
+}
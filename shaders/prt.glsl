@@ -0,0 +1,42 @@
+#version 430
+
+#pragma include("common.glsl")
+#pragma include("sh.glsl")
+#pragma include("cone.glsl")
+
+// precomputed radiance transfer, projects the visibility of the environment from every voxel (the transmittance of
+// raymarch_direct.glsl's diffuse cones, averaged over color) onto order 1 spherical harmonics. Lighting a voxel with
+// any environment is then a dot product with the environment's own projection (see env_sh.glsl)
+layout(local_size_x = 4, local_size_y = 4, local_size_z = 4) in;
+layout(binding = 3) uniform sampler3D sigmaVolume;
+layout(binding = 1) writeonly uniform image3D prtVolume;
+
+uniform ivec3 prtResolution;
+uniform int firstSlice; // a re-bake spreads the build over several frames a slab at a time
+uniform int numSlices;
+uniform uint numRays;
+uniform float bakeLodBias;
+
+void main()
+{
+    ivec3 index = ivec3(gl_GlobalInvocationID.xyz) + ivec3(0, 0, firstSlice);
+    if (any(greaterThanEqual(index, prtResolution)) || index.z >= firstSlice + numSlices)
+    {
+        return;
+    }
+
+    initRNG(ivec2(index.x + index.z * prtResolution.x, index.y), 0);
+
+    vec3 p = (vec3(index) + 0.5) / vec3(prtResolution);
+    vec4 transfer = vec4(0.0);
+    for (uint i = 0; i < numRays; i++)
+    {
+        // stratified over a numRays x 1 grid of the first dimension, jittered in both
+        vec2 u = vec2((float(i) + rand()) / float(numRays), rand());
+        vec3 dir = uniformSphere(u);
+        vec3 visibility = diffuseConeTransmittance(sigmaVolume, p, dir, bakeLodBias);
+        transfer += shBasis(dir) * dot(visibility, vec3(1.0 / 3.0));
+    }
+
+    imageStore(prtVolume, index, transfer * (4.0 * pi / float(numRays)));
+}
@@ -0,0 +1,27 @@
+// ray queues of the wavefront mode: every stage appends the pixels whose rays are still alive and the next stage is
+// dispatched indirectly over just those. A queue's header doubles as the stage's indirect dispatch args, filled in 
+// from its count by queue_args.glsl. Stages keep their 16x16 workgroups and are dispatched (groups, 1, 1)
+
+const uint queueGroupSize = 256u;
+
+uint packPixel(ivec2 p)
+{
+    return uint(p.x) | (uint(p.y) << 16);
+}
+
+ivec2 unpackPixel(uint item)
+{
+    return ivec2(item & 0xffffu, item >> 16);
+}
+
+// position in the queue of the invocation at localIndex of the stage's group-th workgroup
+uint queueItem(uint group, uint localIndex)
+{
+    return group * queueGroupSize + localIndex;
+}
+
+// position of this invocation in the queue its stage was dispatched over
+uint queueItem()
+{
+    return queueItem(gl_WorkGroupID.x, gl_LocalInvocationIndex);
+}
@@ -0,0 +1,15 @@
+#version 430
+
+#pragma include("queue.glsl")
+
+// turns a queue's count into the indirect dispatch args of the stage that consumes it
+layout(local_size_x = 1) in;
+layout(std430, binding = 3) buffer Queue { uvec3 args; uint count; };
+
+uniform uint itemsPerGroup; // queueGroupSize for ray queues
+uniform uint groupsPerItem; // numSamples for the tile list
+
+void main()
+{
+    args = uvec3(((count + itemsPerGroup - 1u) / itemsPerGroup) * groupsPerItem, 1u, 1u);
+}
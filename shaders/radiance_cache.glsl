@@ -0,0 +1,61 @@
+#version 430
+
+#pragma include("common.glsl")
+#pragma include("sh.glsl")
+#pragma include("cone.glsl")
+
+// adds rays to the probes of a slab of the radiance cache. Every probe keeps the running average of the environment
+// radiance reaching it, attenuated by the bake the same way raymarch_direct.glsl's diffuse cones attenuate it,
+// projected onto order 1 spherical harmonics
+layout(local_size_x = 4, local_size_y = 4, local_size_z = 4) in;
+layout(rgba32f, binding = 1) uniform image3D cacheR;
+layout(rgba32f, binding = 2) uniform image3D cacheG;
+layout(rgba32f, binding = 3) uniform image3D cacheB;
+layout(r32f, binding = 4) uniform image3D cacheCount;
+layout(binding = 3) uniform sampler3D sigmaVolume;
+layout(binding = 4) uniform samplerCube cubemap;
+
+uniform ivec3 cacheResolution;
+uniform int firstSlice;
+uniform int numSlices;
+uniform uint raysPerProbe;
+uniform float targetSamples; // count a converged probe stores
+uniform uint update; // seeds the rng
+uniform float bakeLodBias;
+uniform mat3 envRotation; // the environment seen along d is the cubemap along envRotation * d
+
+void main()
+{
+    ivec3 index = ivec3(gl_GlobalInvocationID.xyz) + ivec3(0, 0, firstSlice);
+    if (any(greaterThanEqual(index, cacheResolution)) || index.z >= firstSlice + numSlices)
+    {
+        return;
+    }
+
+    initRNG(ivec2(index.x + index.z * cacheResolution.x, index.y), update);
+
+    // probes sit on texel centers so the direct pass can interpolate them with linear filtering
+    vec3 probe = (vec3(index) + 0.5) / vec3(cacheResolution);
+
+    vec4 shR = vec4(0.0), shG = vec4(0.0), shB = vec4(0.0);
+    for (uint i = 0; i < raysPerProbe; i++)
+    {
+        vec3 dir = uniformSphere(rand2());
+        vec3 radiance = textureLod(cubemap, envRotation * dir, diffuseCubemapLod).rgb * diffuseConeTransmittance(sigmaVolume, probe, dir, bakeLodBias);
+        vec4 basis = shBasis(dir) * (4.0 * pi); // over the uniform pdf
+        shR += radiance.r * basis;
+        shG += radiance.g * basis;
+        shB += radiance.b * basis;
+    }
+
+    float count = imageLoad(cacheCount, index).r;
+    float newCount = count + float(raysPerProbe);
+    float oldWeight = count / newCount;
+    float newWeight = 1.0 / newCount;
+    imageStore(cacheR, index, imageLoad(cacheR, index) * oldWeight + shR * newWeight);
+    imageStore(cacheG, index, imageLoad(cacheG, index) * oldWeight + shG * newWeight);
+    imageStore(cacheB, index, imageLoad(cacheB, index) * oldWeight + shB * newWeight);
+    // the last update of a slab can overshoot the target when it isn't a multiple of raysPerProbe. Converged probes
+    // store exactly the target, so the direct pass's interpolated count only reaches it once all 8 around it have
+    imageStore(cacheCount, index, vec4(min(newCount, targetSamples)));
+}
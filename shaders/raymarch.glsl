@@ -1,6 +1,11 @@
 #version 430
 #pragma include("common.glsl")
 #pragma include("materials.glsl")
+#pragma include("multiscatter.glsl")
+#pragma include("queue.glsl")
+#pragma include("persistent.glsl")
+#pragma include("tiles.glsl")
+#pragma include("gradient_encoding.glsl")
 
 layout(local_size_x = 16, local_size_y = 16) in;
 layout(rgba16f, binding = 0) uniform image2D imgOutput;
@@ -11,6 +16,9 @@ layout(binding = 4) uniform samplerCube cubemap;
 layout(rgba16f, binding = 5) uniform image2D rayPosTex;
 layout(rgba16f, binding = 6) uniform image2D accumTex;
 layout(binding = 7) uniform sampler1D clearcoatLUT; // TODO: replace with cubic function?
+layout(binding = 8) uniform sampler3D classifiedVolume; // only bound when classification == preClassified
+layout(binding = 9) uniform sampler2D preintegratedTable; // only bound when classification == preIntegrated
+layout(binding = 10) uniform sampler3D gradientVolume; // only bound when precomputedGradient is set
 uniform uint numSamples;
 uniform vec3 scaleFactor;
 uniform vec3 scanSize;
@@ -18,7 +26,54 @@ uniform vec3 scanResolution;
 uniform vec3 lowerBound;
 uniform mat4 view;
 uniform int itrs;
-uniform uint depth;
+uniform uint depth; // vertex of the path this pass finds, 1 for camera rays
+uniform float coarseStepScale;
+uniform uint refineSteps;
+uniform uint classification;
+uniform uint precomputedGradient;
+uniform mat3 envRotation; // the environment seen along d is the cubemap along envRotation * d
+layout(binding = 11) uniform sampler3D lightVolume; // transmittance to each light, one per channel
+layout(rgba16f, binding = 7) uniform image2D lightTex; // light reaching the camera through this sample, added by the direct pass
+uniform vec4 lightPositions[4]; // w = 0: xyz is the direction towards a directional light, w = 1: a point light's position
+uniform vec4 lightColors[4];
+uniform int numLights;
+layout(binding = 12) uniform sampler2D msLUT; // only bound when multipleScattering is set
+layout(binding = 13) uniform sampler3D bakedVolume; // only bound when multipleScattering is set
+uniform uint multipleScattering;
+uniform float msRadius; // radius of the neighbourhood the gain assumes is homogeneous, in uvw
+uniform float msBakeLevel; // bake mip about msRadius across
+layout(std430, binding = 3) readonly buffer TraceQueue { uvec3 traceArgs; uint traceCount; uint traceItems[]; };
+layout(std430, binding = 4) buffer DirectQueue { uvec3 directArgs; uint directCount; uint directItems[]; };
+uniform uint wavefront; // this pass runs over the trace queue and queues the rays the direct pass has to finish
+layout(std430, binding = 5) readonly buffer TileQueue { uvec3 tileArgs; uint tileCount; uint tileItems[]; };
+uniform uint adaptive; // dispatched over the tile list of adaptive sampling
+uniform uint activeSamples; // samples per pixel the quality governor lets an iteration take, at most numSamples
+uniform ivec2 renderSize; // pixels rendered at the current render scale, the top left of the ray textures
+uniform ivec2 screenRectMin; // the volume's box projects inside [screenRectMin, screenRectMax), full screen dispatches 
+uniform ivec2 screenRectMax; // only cover that and env_fill.glsl gave the pixels outside it the environment
+layout(r32f, binding = 1) uniform image2D weightTex; // weight of the sample in imgOutput, signed with the vertex's type past depth 1
+
+// temporal reuse: the first iteration after the view changes starts every sample from the previous accumulation 
+// wherever first_hit.glsl found the pixel's first hit where the previous view saw it
+layout(rgba32f, binding = 2) readonly uniform image2D reprojectTex; // see first_hit.glsl
+layout(binding = 15) uniform sampler2D historyTex; // imgOutput as the previous view left it
+uniform uint reproject;
+uniform uint prevActiveSamples;
+uniform float maxHistory; // samples the reprojected history can count as at most
+
+// entry cache: where each pixel's camera rays can first reach content, negative if they can't (gen_rays.glsl 
+// finishes those), see entry_cache.glsl
+layout(r32f, binding = 3) readonly uniform image2D entryTex;
+uniform uint entryCache;
+
+// persistent threads, see persistent.glsl
+uniform uint persistent;
+uniform ivec2 gridGroups; // workgroups of the regular full screen dispatch
+uniform uint schedulerStats; // count the steps the lanes marched and the march iterations their workgroups were resident for
+
+uint marchSteps = 0u; // coarse steps this invocation marched so far
+shared uint groupMaxIterations;
+shared uint groupSteps;
 
 // from Trevor Headstrom's code
 vec2 rayBox(vec3 ro, vec3 rd, vec3 mn, vec3 mx) {
@@ -32,6 +87,12 @@ vec2 rayBox(vec3 ro, vec3 rd, vec3 mn, vec3 mx) {
 
 vec3 calcGradient(vec3 uvw)
 {
+    // gradient.glsl already ran the (central difference or sobel) kernel over every voxel
+    if (precomputedGradient != 0)
+    {
+        return decodeGradient(texture(gradientVolume, uvw));
+    }
+
     vec3 highVals = vec3(
         textureOffset(rawVolume, uvw, ivec3(1, 0, 0)).r,
         textureOffset(rawVolume, uvw, ivec3(0, 1, 0)).r,
@@ -47,64 +108,245 @@ vec3 calcGradient(vec3 uvw)
     return lowVals - highVals;
 }
 
+// surfaces forced by surfaceThresh can sit where the gradient vanishes, those face the ray
+vec3 shadingNormal(vec3 grad, vec3 wo)
+{
+    return dot(grad, grad) > 0.0 ? normalize(grad) : normalize(wo * scaleFactor);
+}
+
 const float farT = 5.0; // hehe
 const float stepSize = 0.001;
 const float densityScale = 0.005;
 const float lightingMult = 1.0;
 const float surfaceThresh = 0.7f;
 
-void trace(in vec3 ro, in vec3 rd, out uint hit, out vec3 uvw)
+// where the transfer functions get applied, see RaytraceSettings::Classification
+const uint postClassified = 0;
+const uint preClassified = 1;
+const uint preIntegrated = 2;
+
+float sampleSigmaT(vec3 uvw)
 {
-    float s = -log(rand()) * densityScale;
+    if (classification == preClassified)
+    {
+        return texture(classifiedVolume, uvw).a;
+    }
 
-    // compute ray in index space
-    ro = (ro - lowerBound) * scaleFactor;
-    rd *= scaleFactor;
+    float density = texture(rawVolume, uvw).r;
+    return texture(opacityLUT, density).r;
+}
 
-    vec2 isect = rayBox(ro, rd, vec3(0.f), vec3(1.f));
-    isect.y = min(3.f, isect.y);
-    isect.x = stepSize * rand();
+// transfer function color in rgb and opacity in a
+vec4 sampleClassified(vec3 uvw)
+{
+    if (classification == preClassified)
+    {
+        return texture(classifiedVolume, uvw);
+    }
+
+    float density = texture(rawVolume, uvw).r;
+    return vec4(texture(transferLUT, density).rgb, texture(opacityLUT, density).r);
+}
 
-    vec3 texelSize = 1 / scanResolution;
-    float eps = min(min(texelSize.x, texelSize.y), texelSize.z) / 64;
+// x: extinction over the step starting at uvw, y: highest opacity inside the step.
+// Point sampled at uvw unless preintegrated, where the slab between the front and back density is looked up instead
+vec2 sampleStep(vec3 uvw, vec3 stepVec, inout float frontDensity)
+{
+    if (classification == preIntegrated)
+    {
+        float backDensity = texture(rawVolume, uvw + stepVec).r;
+        vec2 slab = texture(preintegratedTable, vec2(frontDensity, backDensity)).rg;
+        frontDensity = backDensity;
+        return slab;
+    }
 
-    texelSize *= sign(rd);
+    return vec2(sampleSigmaT(uvw));
+}
 
-    hit = 1;
-    while (s > 0.f)
+// bisects [tLow, tHigh] down to where sigmaT crosses surfaceThresh, sigmaT at tHigh is expected to be above it
+float refineSurfaceHit(vec3 ro, vec3 rd, float tLow, float tHigh)
+{
+    for (uint i = 0; i < refineSteps; i++)
     {
-        if (isect.x >= isect.y)
+        float tMid = (tLow + tHigh) * 0.5;
+        if (sampleSigmaT(ro + tMid * rd) > surfaceThresh)
         {
-            hit = 0;
-            break;
+            tHigh = tMid;
         }
+        else
+        {
+            tLow = tMid;
+        }
+    }
 
-        uvw = ro + isect.x * rd;
+    return tHigh;
+}
 
-        float density = texture(rawVolume, uvw).r;
-        float opacity = texture(opacityLUT, density).r;
-        float sigmaT = opacity;
+// a ray being marched by traceStep(), in index space
+struct March
+{
+    vec3 ro;
+    vec3 rd;
+    vec2 isect;
+    float s; // optical depth left until the free flight ends
+    float tPrev;
+    float frontDensity;
+    uint hit;
+    vec3 uvw;
+};
+
+March beginTrace(vec3 ro, vec3 rd)
+{
+    const float coarseStep = stepSize * coarseStepScale;
 
-        if (sigmaT > surfaceThresh)
-        {
-            break;
-        }
+    March m;
+    m.s = -log(rand()) * densityScale;
 
-        s -= sigmaT * stepSize;
-        isect.x += stepSize;
+    // compute ray in index space
+    m.ro = (ro - lowerBound) * scaleFactor;
+    m.rd = rd * scaleFactor;
+
+    m.isect = rayBox(m.ro, m.rd, vec3(0.f), vec3(1.f));
+    m.isect.y = min(3.f, m.isect.y);
+    m.isect.x = coarseStep * rand();
+
+    m.tPrev = m.isect.x;
+    m.frontDensity = classification == preIntegrated ? texture(rawVolume, m.ro + m.isect.x * m.rd).r : 0.0;
+    m.hit = 1;
+    m.uvw = vec3(0.0);
+    return m;
+}
+
+// one coarse step, true once the ray hit a surface, scattered or left the volume (hit = 0). Marching coarsely and only
+// going back to find the exact hit once the surface threshold has been crossed
+bool traceStep(inout March m)
+{
+    const float coarseStep = stepSize * coarseStepScale;
+    marchSteps++;
+
+    if (m.isect.x >= m.isect.y)
+    {
+        m.hit = 0;
+        return true;
+    }
+
+    m.uvw = m.ro + m.isect.x * m.rd;
+
+    vec2 sigmaT = sampleStep(m.uvw, coarseStep * m.rd, m.frontDensity);
+    if (sigmaT.y > surfaceThresh)
+    {
+        // a point sample crossed somewhere since the last sample, a slab crossed somewhere inside itself
+        vec2 bracket = classification == preIntegrated ? vec2(m.isect.x, m.isect.x + coarseStep) : vec2(m.tPrev, m.isect.x);
+        m.uvw = m.ro + refineSurfaceHit(m.ro, m.rd, bracket.x, bracket.y) * m.rd;
+        return true;
+    }
+
+    m.s -= sigmaT.x * coarseStep;
+    if (m.s <= 0.f)
+    {
+        // the free flight ended somewhere inside this step, so place the collision where the optical depth ran out
+        m.uvw = m.ro + (m.isect.x + coarseStep + m.s / sigmaT.x) * m.rd;
+        return true;
     }
+
+    m.tPrev = m.isect.x;
+    m.isect.x += coarseStep;
+    return false;
 }
 
-void main()
+// light scattered towards wo by the explicit lights, shadowed by the cached transmittance
+vec3 shadeLights(vec3 uvw, vec3 wo, bool surface, vec3 n, vec3 col)
 {
-    // get index in global work group i.e x,y position
-    ivec2 index = ivec2(gl_GlobalInvocationID.xy);
+    vec4 transmittance = texture(lightVolume, uvw);
+    vec3 result = vec3(0.0);
+    for (int i = 0; i < numLights; i++)
+    {
+        vec3 toLight = lightPositions[i].w == 0.0 ? lightPositions[i].xyz : lightPositions[i].xyz - uvw;
+        float falloff = lightPositions[i].w == 0.0 ? 1.0 : 1.0 / max(dot(toLight, toLight), 1e-4);
+        vec3 l = normalize(toLight);
+
+        float pdf;
+        vec3 f = surface ? lambertian(col) * max(dot(n, l), 0.0) : schlickPhase(col, wo, l, 0.0, pdf);
+        result += lightColors[i].rgb * falloff * f * transmittance[i];
+    }
+    return result;
+}
+
+// the previous accumulation of this sample slot in the pixel the previous view saw the pixel's first hit in, with the 
+// number of samples it counts as, scaled down by how sure first_hit.glsl is it saw the same surface there
+vec4 reprojectHistory(ivec2 index)
+{
+    vec4 reprojection = imageLoad(reprojectTex, ivec2(index.x / int(numSamples), index.y));
+    if (reprojection.z <= 0.0)
+    {
+        return vec4(0.0);
+    }
+
+    // the same slot of the previous pixel, or one the previous iteration traced if it took fewer samples
+    uint slot = (uint(index.x) % numSamples) % prevActiveSamples;
+    ivec2 prevIndex = ivec2(int(reprojection.x) * int(numSamples) + int(slot), int(reprojection.y));
+    vec4 history = texelFetch(historyTex, prevIndex, 0);
+    return vec4(history.rgb, clamp(abs(history.a) - 1.0, 0.0, maxHistory) * reprojection.z);
+}
+
+// a sample of the pass whose ray is being marched
+struct Sample
+{
+    ivec2 index;
+    vec3 rd;
+    vec3 accum;
+    March march;
+};
+
+// starts the sample of the invocation at local of the group-th workgroup of the regular dispatch, false when the sample
+// is already done without marching
+bool beginSample(uvec2 group, uvec2 local, out Sample smp)
+{
+    // get index in global work group i.e x,y position, or the queued pixel in wavefront mode, or in the listed tile with adaptive sampling
+    ivec2 index = ivec2(group * gl_WorkGroupSize.xy + local);
+    if (wavefront == 1)
+    {
+        uint item = queueItem(group.x, local.x + local.y * gl_WorkGroupSize.x);
+        if (item >= traceCount)
+        {
+            return false;
+        }
+        index = unpackPixel(traceItems[item]);
+    }
+    else if (adaptive == 1)
+    {
+        if (!tilePixel(tileItems[group.x / numSamples], numSamples, activeSamples, itrs, group.x, local, index))
+        {
+            return false;
+        }
+    }
+    else
+    {
+        index = activeSampleIndex(index, numSamples, activeSamples) + ivec2(screenRectMin.x * int(numSamples), screenRectMin.y);
+    }
     ivec2 screenIndex = ivec2(index.x / numSamples, index.y);
+    if (any(lessThan(screenIndex, screenRectMin)) || any(greaterThanEqual(screenIndex, screenRectMax)))
+    {
+        return false;
+    }
+
+    float entry = depth == 1 && entryCache == 1 ? imageLoad(entryTex, screenIndex).r : 0.0;
+    if (entry < 0.0)
+    {
+        return false;
+    }
     
-    initRNG(index, itrs);
+    initRNG(index, uint(itrs) + (depth - 1u) * 0x9e3779b9u); // every bounce gets its own sequence
     
     vec4 accumPk = imageLoad(accumTex, index);
     vec3 accum = accumPk.rgb;
+
+    // the path ended at an earlier vertex
+    if (depth > 1 && length(accum) < 0.0001)
+    {
+        return false;
+    }
+
     vec4 rayPosPk = imageLoad(rayPosTex, index);
 
     // 3 pieces of data are packed into two textures here:
@@ -115,37 +357,68 @@ void main()
         sin(rayPosPk.w) * sin(accumPk.w),
         cos(rayPosPk.w)
     );
-    vec3 startPos = ro;
+
+    // past the camera the ray continues from the last vertex, which is stored in index space. Step off it so the ray
+    // doesn't find the surface it left right away
+    if (depth > 1)
+    {
+        ro = ro / scaleFactor + lowerBound;
+        rd = normalize(rd / scaleFactor);
+        ro += rd * (2.0 * stepSize * coarseStepScale) / length(rd * scaleFactor);
+    }
 
     vec2 isect = rayBox(ro, rd, lowerBound, -1.0 * lowerBound);
-    isect.x = max(0, isect.x);
+    isect.x = max(entry, isect.x); // camera rays skip the empty space in front of the first content
     isect.y = min(isect.y, farT);
 
     // early out if no bb hit
     if (isect.x >= isect.y)
     {
-        vec3 missCol = texture(cubemap, rd).rgb * lightingMult;
+        // the direct pass already added the environment along a continued ray
+        if (depth > 1)
+        {
+            imageStore(accumTex, index, vec4(0.f));
+            return false;
+        }
+
+        vec3 missCol = texture(cubemap, envRotation * rd).rgb * lightingMult;
         imageStore(imgOutput, index, vec4(missCol, 1.0));
         imageStore(accumTex, index, vec4(0.f));
-        return;
+        return false;
     }
 
     // start raymarching at intersection
     ro += rd * isect.x;
-    isect.y -= isect.x;
 
-    uint hit = 1;
-    vec3 uvw = vec3(0.0);
-    trace(ro, rd, hit, uvw);
+    smp.index = index;
+    smp.rd = rd;
+    smp.accum = accum;
+    smp.march = beginTrace(ro, rd);
+    return true;
+}
 
-    float density = texture(rawVolume, uvw).r;
-    float opacity = texture(opacityLUT, density).r;
+// shades the sample once its ray is done marching
+void finishSample(Sample smp)
+{
+    ivec2 index = smp.index;
+    vec3 rd = smp.rd;
+    vec3 accum = smp.accum;
+    uint hit = smp.march.hit;
+    vec3 uvw = smp.march.uvw;
+
+    vec4 classified = sampleClassified(uvw);
+    float opacity = classified.a;
 
     vec4 lastImgVal = imageLoad(imgOutput, index);
+    if (hit == 0 && depth > 1) // the direct pass at the last vertex already counted the light this ray escaped with
+    {
+        imageStore(accumTex, index, vec4(0.f));
+        return;
+    }
     if (hit == 0) // If the ray exited the volume before a hit
     {
         vec4 invItr = vec4(1.0 / abs(lastImgVal.a));
-        vec3 missCol = texture(cubemap, rd).rgb * (1 - hit) * accum * lightingMult;
+        vec3 missCol = texture(cubemap, envRotation * rd).rgb * (1 - hit) * accum * lightingMult;
         vec4 newCol = lastImgVal * (1.0 - invItr) + vec4(missCol, 1.0) * invItr;
         newCol.a = abs(lastImgVal.a) + 1.f;
 
@@ -154,7 +427,8 @@ void main()
         return;
     }
 
-    vec3 col = texture(transferLUT, density).rgb;
+    vec3 col = classified.rgb;
+    float density = texture(rawVolume, uvw).r; // still needed for the clearcoat lut
 
     // Here we decide if this voxel should be shaded as a surface or volume. 
     // The difference between the two is that surfaces only bounce light rays with a distribution over a hemisphere, 
@@ -167,10 +441,33 @@ void main()
     vec4 wi = vec4(0.0); 
     // shade as a surface if we choose a number less than pBRDF or we have an opacity greater than the surface thresh cutoff
     // I use surfaceThresh to force surface shading at some high opacity value; it's also used earlier in trace() to force terminate a ray
-    if (rand() < pbrdf || opacity > surfaceThresh)
+    bool surface = rand() < pbrdf || opacity > surfaceThresh;
+
+    // gen_rays.glsl restarted the sample's count, carry the previous view's accumulation over instead
+    if (depth == 1 && reproject == 1)
+    {
+        vec4 history = reprojectHistory(index);
+        lastImgVal = vec4(history.rgb, 1.0 + history.a);
+    }
+
+    // light that would reach this sample's single scattering after bounces in the neighbourhood around it, with the
+    // neighbourhood's optical radius at the same extinction scale as the direct pass's cones
+    vec3 msGain = vec3(1.0);
+    if (multipleScattering == 1)
+    {
+        float opticalRadius = pow(textureLod(bakedVolume, uvw, msBakeLevel).a, 1.5) * 10.0 * msRadius;
+        msGain = multipleScatteringGain(msLUT, col, opticalRadius, surface);
+    }
+
+    if (numLights > 0)
+    {
+        imageStore(lightTex, index, vec4(accum * msGain * shadeLights(uvw, wo, surface, shadingNormal(grad, wo), col), 0.0));
+    }
+
+    if (surface)
     {
         const float alpha = 0.9, pClearcoat = texture(clearcoatLUT, density).r;
-        vec3 n = normalize(grad), wm = vec3(0.f);
+        vec3 n = shadingNormal(grad, wo), wm = vec3(0.f);
         if (rand() < .5f) // 50/50 chance of choosing either a clearcoat sample or diffuse sample
         {
             wi.xyz = SampleDisneyClearcoat(wo, n, wm, alpha, uv);
@@ -200,7 +497,7 @@ void main()
         f = lambertian(col);
         pdf = lambertianPDF(wiDotN);
         pct = f * wiDotN;
-        thpt += pct / pdf;
+        thpt += msGain * pct / pdf;
     }
     else
     {
@@ -211,7 +508,7 @@ void main()
         vec3 pct = f;
         wi.w = -1.f;
 
-        thpt = pct / pdf;
+        thpt = msGain * pct / pdf;
     }
 
     // Sometimes a clearcoat sample can be outside of the hemisphere, in this case setting accum to 0 will cause the 
@@ -220,15 +517,113 @@ void main()
     {
         accum = vec3(0.f);
     }
-    
-    imageStore(imgOutput, index, vec4(lastImgVal.rgb, lastImgVal.a * wi.w));
 
-    rayPosPk.xyz = uvw;
-    rayPosPk.w = acos(wi.z);
-    imageStore(rayPosTex, index, rayPosPk);
+    // russian roulette past the first bounce, paths carrying little light end early and the survivors make up for them
+    if (depth > 1)
+    {
+        float survival = min(max(max(accum.r * thpt.r, accum.g * thpt.g), accum.b * thpt.b), 1.0);
+        thpt = rand() < survival ? thpt / survival : vec3(0.f);
+    }
+
+    // the sample's weight was fixed by the camera vertex, later vertices only pass on their type
+    if (depth > 1)
+    {
+        imageStore(weightTex, index, vec4(abs(imageLoad(weightTex, index).r) * wi.w));
+    }
+    else
+    {
+        imageStore(imgOutput, index, vec4(lastImgVal.rgb, lastImgVal.a * wi.w));
+    }
+
+    imageStore(rayPosTex, index, vec4(uvw, acos(wi.z)));
 
     float phiOff = wi.x < 0.0 ? pi : 0.0;
-    accumPk.rgb = accum * thpt;
-    accumPk.a = phiOff + atan(wi.y / wi.x);
+    vec4 accumPk = vec4(accum * thpt, phiOff + atan(wi.y / wi.x));
     imageStore(accumTex, index, accumPk);
+
+    // the direct pass skips the same rays
+    if (wavefront == 1 && length(accumPk.rgb) >= 0.0001)
+    {
+        directItems[atomicAdd(directCount, 1u)] = packPixel(index);
+    }
+}
+
+void main()
+{
+    if (schedulerStats == 1)
+    {
+        if (gl_LocalInvocationIndex == 0)
+        {
+            groupMaxIterations = 0u;
+            groupSteps = 0u;
+        }
+        memoryBarrierShared();
+        barrier();
+    }
+
+    Sample smp;
+    uint iterations = 0u; // of the loop that marches this lane's rays
+    if (persistent == 0)
+    {
+        if (beginSample(gl_WorkGroupID.xy, gl_LocalInvocationID.xy, smp))
+        {
+            bool done = false;
+            while (!done)
+            {
+                done = traceStep(smp.march);
+            }
+            finishSample(smp);
+        }
+        iterations = marchSteps;
+    }
+    else
+    {
+        // the rays of the regular dispatch, whose queue and tile list workgroups are in a row
+        uint numGroups = wavefront == 1 ? traceArgs.x : (adaptive == 1 ? tileArgs.x : uint(gridGroups.x * gridGroups.y));
+        uint groupsPerRow = wavefront == 1 || adaptive == 1 ? max(numGroups, 1u) : uint(gridGroups.x);
+        uint numRays = numGroups * queueGroupSize;
+
+        // while-while: every iteration is one step of the lane's ray, and a lane whose ray is done takes the next one
+        // before the step instead of idling until the rest of its warp is done with theirs
+        uint ray = 0u;
+        bool marching = false;
+        while (true)
+        {
+            while (!marching && ray < numRays)
+            {
+                ray = atomicAdd(nextRay, 1u);
+                if (ray < numRays)
+                {
+                    uint group = ray / queueGroupSize, local = ray % queueGroupSize;
+                    marching = beginSample(uvec2(group % groupsPerRow, group / groupsPerRow), uvec2(local % gl_WorkGroupSize.x, local / gl_WorkGroupSize.x), smp);
+                }
+            }
+            if (!marching)
+            {
+                break;
+            }
+
+            iterations++;
+            if (traceStep(smp.march))
+            {
+                finishSample(smp);
+                marching = false;
+            }
+        }
+    }
+
+    // a workgroup holds on to its slot on the gpu until its last lane is done, so it's resident for as many 
+    // iterations as that lane ran, and whatever of them the other lanes didn't spend marching was idle
+    if (schedulerStats == 1)
+    {
+        atomicMax(groupMaxIterations, iterations);
+        atomicAdd(groupSteps, marchSteps);
+        memoryBarrierShared();
+        barrier();
+        if (gl_LocalInvocationIndex == 0)
+        {
+            addLaneSteps(0, groupSteps);
+            addLaneSteps(2, groupMaxIterations * gl_WorkGroupSize.x * gl_WorkGroupSize.y);
+        }
+    }
 }
\ No newline at end of file
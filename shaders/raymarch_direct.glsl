@@ -6,6 +6,11 @@
 #extension GL_KHR_shader_subgroup_shuffle : require
 
 #pragma include("common.glsl")
+#pragma include("svo.glsl")
+#pragma include("sat.glsl")
+#pragma include("sh.glsl")
+#pragma include("queue.glsl")
+#pragma include("tiles.glsl")
 
 layout(local_size_x = 16, local_size_y = 16) in;
 layout(rgba16f, binding = 0) uniform image2D imgOutput;
@@ -18,6 +23,45 @@ uniform uint numSamples;
 uniform vec3 scaleFactor;
 uniform vec3 lowerBound;
 uniform int itrs;
+uniform float bakeLodBias; // log2 of how much finer the bake is than the 128^3 the cone spread was tuned for
+layout(binding = 8) uniform sampler3D anisoVolume; // per axis opacity of the bake's mips
+uniform uint anisotropic;
+uniform float coneStepScale;
+uniform uint svoDepth; // 0 without an octree
+uniform vec3 svoScale; // uvw to the octree's cube
+uniform float svoLevelBias; // log2 of how many scan voxels a baked voxel spans
+layout(binding = 9) uniform sampler3D satVolume; // summed-area table of the bake's extinction
+uniform uint summedAreaTable;
+uniform vec3 bakeResolution;
+layout(binding = 10) uniform sampler3D radianceCacheR; // order 1 sh of the radiance reaching the cache's probes
+layout(binding = 11) uniform sampler3D radianceCacheG;
+layout(binding = 12) uniform sampler3D radianceCacheB;
+layout(binding = 13) uniform sampler3D radianceCacheCount;
+uniform uint radianceCache;
+uniform float radianceCacheSamples; // rays a probe needs before it's used instead of tracing
+layout(binding = 14) uniform sampler3D prtVolume; // order 1 sh of each voxel's visibility of the environment
+layout(std430, binding = 2) readonly buffer EnvSh { vec4 envSh[3]; }; // order 1 sh of the unrotated environment
+uniform uint prt;
+uniform mat3 envRotation; // the environment seen along d is the cubemap along envRotation * d
+layout(rgba16f, binding = 7) uniform image2D lightTex; // explicit lights' contribution, shaded by raymarch.glsl
+uniform int numLights;
+layout(std430, binding = 4) readonly buffer DirectQueue { uvec3 directArgs; uint directCount; uint directItems[]; };
+uniform uint wavefront; // runs over the direct queue filled by raymarch.glsl
+layout(std430, binding = 5) readonly buffer TileQueue { uvec3 tileArgs; uint tileCount; uint tileItems[]; };
+uniform uint adaptive; // dispatched over the tile list of adaptive sampling
+uniform uint activeSamples; // samples per pixel the quality governor lets an iteration take, at most numSamples
+uniform ivec2 renderSize; // pixels rendered at the current render scale, the top left of the ray textures
+uniform ivec2 screenRectMin; // the volume's box projects inside [screenRectMin, screenRectMax), full screen dispatches 
+uniform ivec2 screenRectMax; // only cover that and env_fill.glsl gave the pixels outside it the environment
+uniform uint depth; // vertex of the path being lit, 1 for the camera ray's
+layout(r32f, binding = 1) uniform image2D weightTex; // weight the camera vertex averaged its sample in with, see raymarch.glsl
+
+// the l1 band rotates like a vector, (l0, y, z, x) order
+vec4 rotateEnvSh(vec4 sh)
+{
+    vec3 v = transpose(envRotation) * sh.wyz;
+    return vec4(sh.x, v.y, v.z, v.x);
+}
 
 // from Trevor Headstrom's code
 vec2 rayBox(vec3 ro, vec3 rd, vec3 mn, vec3 mx) {
@@ -46,7 +90,7 @@ void trace(in vec3 ro, in vec3 rd, in vec2 isect, in float diffuse, out vec3 tra
     const uvec4 startActive = subgroupBallot(true);
     const uvec4 clearcoatThreads = subgroupBallot(diffuse < .5f);
 
-    float multiplier = diffuse * (coneSpread / voxelSize), stepMultiplier = 1.f;
+    float multiplier = diffuse * (coneSpread / voxelSize), stepMultiplier = coneStepScale;
     vec3 linearDensity = vec3(0.0f);
     uvec4 needsHelp = uvec4(1, 0, 0, 0), finished = uvec4(0);
     bool imDone = false;
@@ -68,10 +112,39 @@ void trace(in vec3 ro, in vec3 rd, in vec2 isect, in float diffuse, out vec3 tra
 
         vec3 uvw = ro + isect.x * rd;
         float l = multiplier * isect.x + stepSize * (diffuse > .5f ? 1.f : 10.f);
-        float level = log2(l);
+        float level = log2(l) + bakeLodBias;
+
+        vec4 bakedVal;
+        if (svoDepth > 0 && level < 0.f)
+        {
+            // cones narrower than a baked voxel read the octree at the depth matching their width, down to single 
+            // scan voxels in occupied space
+            int svoLevel = clamp(int(round(float(svoDepth) - level - svoLevelBias)), 0, int(svoDepth));
+            bakedVal = sampleSvo(clamp(uvw, 0.f, 1.f) * svoScale, svoLevel);
+        }
+        else
+        {
+            bakedVal = textureLod(sigmaVolume, uvw, min(mipmapHardcap + bakeLodBias, level));
+        }
+        
+        if (anisotropic == 1 && level >= 0.f)
+        {
+            // blend the three axis opacities by how much of the ray runs along each
+            bakedVal.a = dot(rd * rd, textureLod(anisoVolume, uvw, min(mipmapHardcap + bakeLodBias, level)).xyz);
+        }
 
-        vec4 bakedVal = textureLod(sigmaVolume, uvw, min(mipmapHardcap, level));
-        vec3 sigmaT = vec3(pow(bakedVal.a, 1.5f) * l) * (vec3(1.f) - bakedVal.rgb);
+        float extinction = pow(bakedVal.a, 1.5f);
+        if (summedAreaTable == 1 && level >= 0.f)
+        {
+            // exact average over a box as wide as the cone instead of the nearest two mips, snapped to whole voxels
+            // so every corner is a single texel and at least one voxel wide
+            vec3 halfWidth = vec3(0.5f * exp2(min(mipmapHardcap + bakeLodBias, level)));
+            vec3 center = uvw * bakeResolution;
+            ivec3 lo = ivec3(round(center - halfWidth));
+            ivec3 hi = max(ivec3(round(center + halfWidth)), lo + 1);
+            extinction = satBoxAverage(satVolume, lo, hi, ivec3(bakeResolution));
+        }
+        vec3 sigmaT = vec3(extinction * l * stepMultiplier) * (vec3(1.f) - bakedVal.rgb);
         
         helperSigmaT = vec3(imDone ? sigmaT : vec3(0.f));
         if (!imDone)
@@ -81,7 +154,7 @@ void trace(in vec3 ro, in vec3 rd, in vec2 isect, in float diffuse, out vec3 tra
                 subgroupBarrier();
                 helperSigmaT = subgroupAdd(helperSigmaT);
                 linearDensity += helperSigmaT;
-                isect.x += numHelpers * l;
+                isect.x += numHelpers * l * stepMultiplier;
             }
 
             linearDensity += sigmaT;
@@ -103,9 +176,33 @@ void trace(in vec3 ro, in vec3 rd, in vec2 isect, in float diffuse, out vec3 tra
 
 void main()
 {
-    // get index in global work group i.e x,y position
+    // get index in global work group i.e x,y position, or the queued pixel in wavefront mode, or in the listed tile with adaptive sampling
     ivec2 index = ivec2(gl_GlobalInvocationID.xy);
+    if (wavefront == 1)
+    {
+        uint item = queueItem();
+        if (item >= directCount)
+        {
+            return;
+        }
+        index = unpackPixel(directItems[item]);
+    }
+    else if (adaptive == 1)
+    {
+        if (!tilePixel(tileItems[gl_WorkGroupID.x / numSamples], numSamples, activeSamples, itrs, index))
+        {
+            return;
+        }
+    }
+    else
+    {
+        index = activeSampleIndex(index, numSamples, activeSamples) + ivec2(screenRectMin.x * int(numSamples), screenRectMin.y);
+    }
     ivec2 screenIndex = ivec2(index.x / numSamples, index.y);
+    if (any(lessThan(screenIndex, screenRectMin)) || any(greaterThanEqual(screenIndex, screenRectMax)))
+    {
+        return;
+    }
 
     vec4 accumPk = imageLoad(accumTex, index);
     vec3 accum = accumPk.rgb;
@@ -113,7 +210,7 @@ void main()
     if (length(accum) < 0.0001) return;
 
     // TODO: seed better
-    initRNG(index, itrs);
+    initRNG(index, uint(itrs) + (depth - 1u) * 0x9e3779b9u);
 
     vec4 rayPosPk = imageLoad(rayPosTex, index);
 
@@ -132,14 +229,49 @@ void main()
     vec4 lastImgVal = imageLoad(imgOutput, index);
 
     vec3 transmittance;
-    float diffuse = (-1.f * sign(lastImgVal.a) + 1.f) * .5f; // 1.f if it should use voxel cone tracing, 0.f for clearcoat
-    trace(ro, rd, isect, diffuse, transmittance);
+    float weight = depth > 1 ? imageLoad(weightTex, index).r : lastImgVal.a; // only the sign of lastImgVal.a matters here
+    float diffuse = (-1.f * sign(weight) + 1.f) * .5f; // 1.f if it should use voxel cone tracing, 0.f for clearcoat
+
+    // diffuse samples read the radiance cache once every probe around them has converged, the interpolated count 
+    // only reaches the target when all 8 have
+    vec3 radiance;
+    if (prt == 1 && diffuse > .5f)
+    {
+        // the environment along the sampled direction times the voxel's visibility of it, both from their sh. The 
+        // direction was importance sampled from the lobe, so like a traced cone this is all the sample needs
+        vec4 transfer = texture(prtVolume, ro);
+        float visibility = clamp(dot(transfer, shBasis(rd)), 0.f, 1.f);
+        radiance = shEvaluate(rotateEnvSh(envSh[0]), rotateEnvSh(envSh[1]), rotateEnvSh(envSh[2]), rd) * visibility;
+    }
+    else if (radianceCache == 1 && diffuse > .5f && texture(radianceCacheCount, ro).r >= radianceCacheSamples - .5f)
+    {
+        radiance = shEvaluate(texture(radianceCacheR, ro), texture(radianceCacheG, ro), texture(radianceCacheB, ro), rd);
+    }
+    else
+    {
+        trace(ro, rd, isect, diffuse, transmittance);
+
+        float cubemapLod = diffuse * 7.416f;
+        radiance = textureLod(cubemap, envRotation * rd, cubemapLod).rgb * transmittance;
+    }
 
     // 1 / sampleCount
     vec4 invItr = vec4(1.f / abs(lastImgVal.a));
 
-    float cubemapLod = diffuse * 7.416f;
-    vec3 incoming = textureLod(cubemap, rd, cubemapLod).rgb * transmittance * accum;
+    vec3 incoming = radiance * accum;
+    if (numLights > 0)
+    {
+        incoming += imageLoad(lightTex, index).rgb;
+    }
+
+    // later vertices add to the sample the camera vertex already averaged in
+    if (depth > 1)
+    {
+        imageStore(imgOutput, index, vec4(lastImgVal.rgb + incoming * abs(weight), lastImgVal.a));
+        return;
+    }
+    imageStore(weightTex, index, invItr);
+
     vec4 newCol = lastImgVal * (1.f - invItr) + vec4(incoming, 1.f) * invItr;
 
     // add 1 to the sample count if this is not clearcoat (since clearcoat is additive and it's should not count towards mixed samples)
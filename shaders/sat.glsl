@@ -0,0 +1,38 @@
+// 3D summed-area table of the bake's extinction (opacity^1.5), see sat_scan.glsl. Sums are float-float (hi, lo) so
+// differences near the far corner of the table don't cancel away, an r32f table just leaves lo at 0
+
+// hi/lo sum of two float-float values (Knuth's two-sum on the hi parts)
+vec2 addFF(vec2 a, vec2 b)
+{
+    precise float s = a.x + b.x;
+    precise float v = s - a.x;
+    precise float e = (a.x - (s - v)) + (b.x - v) + a.y + b.y;
+    precise float hi = s + e;
+    return vec2(hi, e - (hi - s));
+}
+
+// float-float sum of the voxels in [0, p) of a table of dims voxels, the table entry of voxel p - 1. Corners on voxel
+// boundaries need no filtering, which would interpolate hi and lo on their own and drop what lo is there for
+vec2 satSum(sampler3D sat, ivec3 p, ivec3 dims)
+{
+    ivec3 q = min(p, dims) - 1;
+    return any(lessThan(q, ivec3(0))) ? vec2(0.0) : texelFetch(sat, q, 0).rg;
+}
+
+// average over the box [lo, hi) in voxels, whatever part of it is outside the table counts as empty. One fetch per 
+// corner, and the corners cancel in float-float, so small boxes near the far corner of the table keep their few 
+// significant bits
+float satBoxAverage(sampler3D sat, ivec3 lo, ivec3 hi, ivec3 dims)
+{
+    vec2 sum = satSum(sat, hi, dims);
+    sum = addFF(sum, -satSum(sat, ivec3(lo.x, hi.y, hi.z), dims));
+    sum = addFF(sum, -satSum(sat, ivec3(hi.x, lo.y, hi.z), dims));
+    sum = addFF(sum, -satSum(sat, ivec3(hi.x, hi.y, lo.z), dims));
+    sum = addFF(sum, satSum(sat, ivec3(hi.x, lo.y, lo.z), dims));
+    sum = addFF(sum, satSum(sat, ivec3(lo.x, hi.y, lo.z), dims));
+    sum = addFF(sum, satSum(sat, ivec3(lo.x, lo.y, hi.z), dims));
+    sum = addFF(sum, -satSum(sat, lo, dims));
+
+    vec3 extent = vec3(hi - lo);
+    return max(sum.x + sum.y, 0.0) / max(extent.x * extent.y * extent.z, 1.0);
+}
@@ -0,0 +1,64 @@
+#version 430
+#extension GL_EXT_shader_image_load_formatted : require
+
+#pragma include("sat.glsl")
+
+// one pass of the summed-area table build, every workgroup prefix sums one row along the pass's axis in chunks of
+// 256 through shared memory. Running it along x, y then z gives the 3D table
+layout(local_size_x = 256) in;
+layout(binding = 1) uniform sampler3D bakedVolume;
+layout(binding = 2) uniform image3D sat; // r32f or rg32f
+
+uniform ivec3 resolution;
+uniform int axis;
+uniform uint fromBake; // the x pass reads the bake's extinction, the others the pass before
+
+const int chunkSize = 256;
+
+shared vec2 scan[chunkSize];
+
+void main()
+{
+    // the two other axes pick the row
+    ivec3 axisDir = ivec3(axis == 0, axis == 1, axis == 2);
+    ivec3 rowOrigin = axis == 0 ? ivec3(0, gl_WorkGroupID.xy) : (axis == 1 ? ivec3(gl_WorkGroupID.x, 0, gl_WorkGroupID.y) : ivec3(gl_WorkGroupID.xy, 0));
+    int rowLength = resolution[axis];
+    int local = int(gl_LocalInvocationID.x);
+
+    vec2 carry = vec2(0.0);
+    for (int chunk = 0; chunk < rowLength; chunk += chunkSize)
+    {
+        int i = chunk + local;
+        ivec3 p = rowOrigin + axisDir * i;
+
+        vec2 value = vec2(0.0);
+        if (i < rowLength)
+        {
+            value = fromBake == 1 ? vec2(pow(texelFetch(bakedVolume, p, 0).a, 1.5), 0.0) : imageLoad(sat, p).rg;
+        }
+        scan[local] = value;
+
+        // Hillis-Steele inclusive scan
+        for (int offset = 1; offset < chunkSize; offset *= 2)
+        {
+            memoryBarrierShared();
+            barrier();
+            vec2 other = local >= offset ? scan[local - offset] : vec2(0.0);
+            memoryBarrierShared();
+            barrier();
+            scan[local] = addFF(scan[local], other);
+        }
+
+        memoryBarrierShared();
+        barrier();
+
+        if (i < rowLength)
+        {
+            imageStore(sat, p, vec4(addFF(scan[local], carry), 0.0, 0.0));
+        }
+        carry = addFF(carry, scan[chunkSize - 1]);
+
+        // the next chunk overwrites the scan
+        barrier();
+    }
+}
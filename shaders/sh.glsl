@@ -0,0 +1,25 @@
+// order 1 (4 coefficient) real spherical harmonics, coefficients are stored (l0, l1 y, l1 z, l1 x) per color channel
+
+const float shY0 = 0.282095;
+const float shY1 = 0.488603;
+
+vec4 shBasis(vec3 dir)
+{
+    return vec4(shY0, shY1 * dir.y, shY1 * dir.z, shY1 * dir.x);
+}
+
+// function the coefficients project to, in direction dir
+vec3 shEvaluate(vec4 shR, vec4 shG, vec4 shB, vec3 dir)
+{
+    vec4 basis = shBasis(dir);
+    return max(vec3(dot(shR, basis), dot(shG, basis), dot(shB, basis)), vec3(0.0));
+}
+
+// uniformly distributed direction from 2 uniform randoms
+vec3 uniformSphere(vec2 u)
+{
+    float z = 1.0 - 2.0 * u.x;
+    float r = sqrt(max(0.0, 1.0 - z * z));
+    float phi = twoPi * u.y;
+    return vec3(r * cos(phi), r * sin(phi), z);
+}
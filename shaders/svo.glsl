@@ -0,0 +1,50 @@
+// sparse voxel octree of baked (color, opacity) over a power of 2 cube of scan voxels, see svo_build.glsl
+// nodes are stored level by level, the 8 children of a node are consecutive and child == 0 marks a leaf
+// coordinates have 16 bits per axis and the octree is at most 2^15 nodes across, so a valid x | y << 16 is never 
+// svoInvalidCoord. A node is 24 bytes in std430
+struct SvoNode
+{
+    uvec2 coord; // (x | y << 16, z) in nodes of the node's level
+    uvec2 value; // rgba as halfs
+    uint child;
+};
+
+layout(std430, binding = 0) buffer SvoNodes { SvoNode svoNodes[]; };
+
+const uint svoInvalidCoord = 0xffffffffu;
+
+uvec2 packSvoCoord(ivec3 p)
+{
+    return uvec2(uint(p.x) | (uint(p.y) << 16), uint(p.z));
+}
+
+ivec3 unpackSvoCoord(uvec2 coord)
+{
+    return ivec3(coord.x & 0xffffu, coord.x >> 16, coord.y);
+}
+
+vec4 unpackSvoValue(uvec2 value)
+{
+    return vec4(unpackHalf2x16(value.x), unpackHalf2x16(value.y));
+}
+
+// value of the node containing p (in [0, 1) of the octree's cube) at depth maxLevel, or of the leaf above it
+vec4 sampleSvo(vec3 p, int maxLevel)
+{
+    uint node = 0;
+    for (int d = 0; d < maxLevel; d++)
+    {
+        uint child = svoNodes[node].child;
+        if (child == 0)
+        {
+            break;
+        }
+
+        p *= 2.0;
+        ivec3 octant = min(ivec3(p), ivec3(1));
+        p -= vec3(octant);
+        node = child + uint(octant.x + octant.y * 2 + octant.z * 4);
+    }
+
+    return unpackSvoValue(svoNodes[node].value);
+}
@@ -0,0 +1,87 @@
+#version 430
+
+#pragma include("svo.glsl")
+
+// builds one level of the sparse voxel octree: evaluates the (color, opacity) of every node made by the level
+// above and gives the ones with content 8 children for the next level
+layout(local_size_x = 64) in;
+layout(binding = 1) uniform sampler3D rawVolume;
+layout(binding = 2) uniform sampler1D transferLUT;
+layout(binding = 3) uniform sampler1D opacityLUT;
+layout(binding = 4) uniform sampler3D bakedVolume;
+layout(std430, binding = 1) buffer SvoCounter { uint nodeCount; };
+
+uniform uint levelStart;
+uniform uint levelCount;
+uniform uint depth;
+uniform uint svoDepth;
+uniform uint maxNodes;
+uniform ivec3 scanResolution;
+uniform float bakeLevelBias; // log2 of how many scan voxels a baked voxel spans
+uniform float subdivideOpacity;
+
+// nodes this small average the classified scan voxels directly, bigger ones read the bake's mips
+const int directSize = 8;
+
+vec4 evaluate(ivec3 start, int size)
+{
+    if (size > directSize)
+    {
+        vec3 center = (vec3(start) + float(size) * 0.5) / vec3(scanResolution);
+        return textureLod(bakedVolume, center, log2(float(size)) - bakeLevelBias); // border is empty
+    }
+
+    // the octree is a power of 2 cube, whatever hangs past the scan is empty
+    vec4 sum = vec4(0.0);
+    ivec3 end = min(start + size, scanResolution);
+    for (int z = start.z; z < end.z; z++)
+    {
+        for (int y = start.y; y < end.y; y++)
+        {
+            for (int x = start.x; x < end.x; x++)
+            {
+                float density = texelFetch(rawVolume, ivec3(x, y, z), 0).r;
+                sum += vec4(texture(transferLUT, density).rgb, texture(opacityLUT, density).r);
+            }
+        }
+    }
+
+    return sum / float(size * size * size);
+}
+
+void main()
+{
+    if (gl_GlobalInvocationID.x >= levelCount)
+    {
+        return;
+    }
+
+    uint index = levelStart + gl_GlobalInvocationID.x;
+    uvec2 coord = svoNodes[index].coord;
+    if (coord.x == svoInvalidCoord)
+    {
+        // slot of a failed allocation, nothing points at it
+        return;
+    }
+
+    int size = 1 << (svoDepth - depth);
+    vec4 value = evaluate(unpackSvoCoord(coord) * size, size);
+    svoNodes[index].value = uvec2(packHalf2x16(value.rg), packHalf2x16(value.ba));
+
+    uint child = 0;
+    if (depth < svoDepth && value.a > subdivideOpacity)
+    {
+        uint first = atomicAdd(nodeCount, 8);
+        for (uint i = 0; i < 8 && first + i < maxNodes; i++)
+        {
+            ivec3 offset = ivec3(i & 1, (i >> 1) & 1, i >> 2);
+            svoNodes[first + i].child = 0;
+            svoNodes[first + i].coord = first + 8 <= maxNodes ? packSvoCoord(unpackSvoCoord(coord) * 2 + offset) : uvec2(svoInvalidCoord);
+        }
+
+        // out of nodes, this one stays a leaf
+        child = first + 8 <= maxNodes ? first : 0;
+    }
+
+    svoNodes[index].child = child;
+}
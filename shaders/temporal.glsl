@@ -0,0 +1,18 @@
+// first hit g-buffer of temporal reuse, see first_hit.glsl. Every pixel keeps where its center ray is most likely to 
+// first scatter (uvw as float bits in xyz) and the bake's normal there (10 bits per axis in w with bit 30 set)
+
+const uint gbufferMiss = 0xffffffffu; // in x when the ray left the volume without a hit
+const uint gbufferHasNormal = 1u << 30;
+
+uvec4 packGBuffer(vec3 uvw, bool hasNormal, vec3 n)
+{
+    uvec3 q = uvec3(clamp(n * 0.5 + 0.5, 0.0, 1.0) * 1023.0 + 0.5);
+    uint packedNormal = hasNormal ? (q.x | (q.y << 10) | (q.z << 20) | gbufferHasNormal) : 0u;
+    return uvec4(floatBitsToUint(uvw), packedNormal);
+}
+
+vec3 unpackGBufferNormal(uint packedNormal)
+{
+    uvec3 q = uvec3(packedNormal, packedNormal >> 10, packedNormal >> 20) & 0x3ffu;
+    return normalize(vec3(q) / 1023.0 * 2.0 - 1.0);
+}
@@ -0,0 +1,70 @@
+#version 430
+
+#pragma include("tiles.glsl")
+
+// estimates the noise left in every 16x16 tile and lists the ones above the threshold with a sample count in 
+// proportion to it. The numSamples samples of a pixel are independent running means, so their spread is the second 
+// moment the pixel's error comes from without having to accumulate one
+layout(local_size_x = 16, local_size_y = 16) in;
+layout(rgba16f, binding = 0) readonly uniform image2D imgOutput;
+layout(std430, binding = 5) buffer TileQueue { uvec3 tileArgs; uint tileCount; uint tileItems[]; };
+
+uniform uint numSamples;
+uniform uint activeSamples; // only these samples are being traced, the rest are left over from before the governor lowered quality
+uniform ivec2 renderSize; // pixels past it are left over from a larger render scale and don't count
+uniform int itrs;
+uniform int minItrs; // every tile takes all its samples until then
+uniform float threshold; // relative standard error a tile counts as converged below
+
+const float darkFloor = 0.05; // darker pixels count as this bright so background noise isn't measured relative to ~0
+const float fullErrorScale = 4.0; // tiles this many times over the threshold take every sample
+
+shared float tileError[tileSize * tileSize];
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+
+    float sum = 0.0, sumSq = 0.0;
+    for (uint s = 0; s < activeSamples; s++)
+    {
+        vec3 col = imageLoad(imgOutput, ivec2(pixel.x * int(numSamples) + int(s), pixel.y)).rgb;
+        float lum = dot(col, vec3(0.2126, 0.7152, 0.0722));
+        sum += lum;
+        sumSq += lum * lum;
+    }
+
+    // standard error of the pixel's mean over its samples' means
+    float n = float(activeSamples);
+    float mean = sum / n;
+    float variance = max(sumSq / n - mean * mean, 0.0) * n / max(n - 1.0, 1.0);
+    uint local = gl_LocalInvocationIndex;
+    tileError[local] = all(lessThan(pixel, renderSize)) ? sqrt(variance / n) / max(mean, darkFloor) : 0.0;
+
+    // worst pixel of the tile
+    for (uint stride = tileSize * tileSize / 2; stride > 0; stride /= 2)
+    {
+        memoryBarrierShared();
+        barrier();
+        if (local < stride)
+        {
+            tileError[local] = max(tileError[local], tileError[local + stride]);
+        }
+    }
+    memoryBarrierShared();
+    barrier();
+
+    if (local != 0)
+    {
+        return;
+    }
+
+    float error = tileError[0];
+    if (itrs > minItrs && error < threshold)
+    {
+        return;
+    }
+
+    uint samples = itrs > minItrs ? uint(ceil(n * min(error / (threshold * fullErrorScale), 1.0))) : activeSamples;
+    tileItems[atomicAdd(tileCount, 1u)] = packTile(ivec2(gl_WorkGroupID.xy), clamp(samples, 1u, activeSamples));
+}
@@ -0,0 +1,36 @@
+// unconverged tiles of adaptive sampling, listed by tile_error.glsl with how many of their pixels' samples to take.
+// A tile is 16x16 screen pixels, passes dispatched over the list run numSamples 16x16 groups per tile, one for each 
+// 16 pixel wide column of its samples
+
+const int tileSize = 16;
+
+uint packTile(ivec2 tile, uint samples)
+{
+    return uint(tile.x) | (uint(tile.y) << 12) | (samples << 24);
+}
+
+// index in the listed tile of the invocation at local of the group-th workgroup dispatched over the list, false when
+// its sample isn't taken this iteration. The samples taken rotate through the active ones with the iteration, a slot 
+// left out for good would keep its noise and hold the tile's error up
+bool tilePixel(uint item, uint numSamples, uint activeSamples, int itrs, uint group, uvec2 local, out ivec2 index)
+{
+    ivec2 tile = ivec2(item & 0xfffu, (item >> 12) & 0xfffu);
+    uint samples = item >> 24;
+    int column = int(group % numSamples);
+    index = tile * ivec2(tileSize * int(numSamples), tileSize) + ivec2(column * tileSize, 0) + ivec2(local);
+    uint slot = uint(index.x) % numSamples;
+    return slot < activeSamples && (slot + uint(itrs)) % activeSamples < samples;
+}
+
+// index of this invocation in the listed tile
+bool tilePixel(uint item, uint numSamples, uint activeSamples, int itrs, out ivec2 index)
+{
+    return tilePixel(item, numSamples, activeSamples, itrs, gl_WorkGroupID.x, gl_LocalInvocationID.xy, index);
+}
+
+// index of a full screen invocation when only the first activeSamples samples of every pixel are traced, the grid is
+// then dispatched activeSamples wide per pixel instead of numSamples
+ivec2 activeSampleIndex(ivec2 invocation, uint numSamples, uint activeSamples)
+{
+    return ivec2((uint(invocation.x) / activeSamples) * numSamples + uint(invocation.x) % activeSamples, invocation.y);
+}
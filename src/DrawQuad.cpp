@@ -16,7 +16,8 @@ void attachShader(GLuint mProgram, GLenum type, const char* code) {
 }
 
 DrawQuad::DrawQuad(glm::ivec2 size, uint32_t samples)
-	: mNumSamples(samples)
+	: mSize(size)
+	, mNumSamples(samples)
 {
 	GLfloat data[8] = {
 	  -1,-1, -1, 1,
@@ -55,13 +56,16 @@ DrawQuad::~DrawQuad()
 	glDeleteProgram(mProgram);
 }
 
-void DrawQuad::Execute(const UniqueTexture& texture)
+void DrawQuad::Execute(const UniqueTexture& texture, uint32_t activeSamples, glm::ivec2 renderSize)
 {
 	glUseProgram(mProgram);
 	glBindImageTexture(
 		0, texture.Get(), 0, false, 0, GL_READ_WRITE, GL_RGBA16F);
 	glUniform1i(0, 0);
 	glUniform1ui(1, mNumSamples);
+	glUniform1ui(2, activeSamples);
+	glUniform2i(3, renderSize.x, renderSize.y);
+	glUniform2f(4, float(mSize.x), float(mSize.y));
 	glBindVertexArray(mArray);
 	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 }
\ No newline at end of file
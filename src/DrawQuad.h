@@ -1,7 +1,7 @@
 #pragma once
 
 #include <gl/glew.h>
-#include <glm/fwd.hpp>
+#include <glm/glm.hpp>
 
 #include "GLObjects.h"
 
@@ -11,9 +11,12 @@ public:
 	DrawQuad(glm::ivec2 size, uint32_t samples);
 	~DrawQuad();
 
-	void Execute(const UniqueTexture& texture);
+	// averages the first activeSamples of every pixel's samples, and upscales the renderSize corner of the texture 
+	// to the output size with an edge aware filter if it's smaller
+	void Execute(const UniqueTexture& texture, uint32_t activeSamples, glm::ivec2 renderSize);
 
 private:
+	glm::ivec2 mSize;
 	uint32_t mNumSamples;
 	GLuint mArray;
 	GLuint mProgram;
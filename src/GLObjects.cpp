@@ -44,6 +44,81 @@ Cubemap::Cubemap(const std::vector<std::string>& filenames)
 	glGenerateTextureMipmap(mUniqueTexture.Get());
 }
 
+GpuTimer::GpuTimer()
+	: mQueries()
+	, mNext(0)
+	, mPending(0)
+	, mTotalMs(0.0)
+	, mLastMs(0.0)
+	, mCount(0)
+{
+	glGenQueries(GLsizei(mQueries.size()), mQueries.data());
+}
+
+GpuTimer::~GpuTimer()
+{
+	glDeleteQueries(GLsizei(mQueries.size()), mQueries.data());
+}
+
+void GpuTimer::Begin()
+{
+	// the slot about to be reused has to be read back first
+	Resolve(mPending == RingSize);
+	glQueryCounter(mQueries[mNext * 2], GL_TIMESTAMP);
+}
+
+void GpuTimer::End()
+{
+	glQueryCounter(mQueries[mNext * 2 + 1], GL_TIMESTAMP);
+	mNext = (mNext + 1) % RingSize;
+	mPending++;
+}
+
+void GpuTimer::Reset()
+{
+	Flush();
+
+	mTotalMs = 0.0;
+	mLastMs = 0.0;
+	mCount = 0;
+}
+
+void GpuTimer::Flush()
+{
+	while (mPending > 0)
+	{
+		Resolve(true);
+	}
+}
+
+void GpuTimer::Resolve(bool wait)
+{
+	while (mPending > 0)
+	{
+		const size_t oldest = (mNext + RingSize - mPending) % RingSize;
+
+		GLint available = GL_FALSE;
+		glGetQueryObjectiv(mQueries[oldest * 2 + 1], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available && !wait)
+		{
+			break;
+		}
+
+		// GL_QUERY_RESULT blocks until the result is in
+		GLuint64 begin, end;
+		glGetQueryObjectui64v(mQueries[oldest * 2], GL_QUERY_RESULT, &begin);
+		glGetQueryObjectui64v(mQueries[oldest * 2 + 1], GL_QUERY_RESULT, &end);
+
+		mLastMs = double(end - begin) * 1e-6;
+		mTotalMs += mLastMs;
+		mCount++;
+		mPending--;
+
+		// only the oldest result is worth waiting on
+		wait = false;
+	}
+}
+
 std::string processIncludes(std::string source, const std::string& includeDir)
 {
 	const static std::regex include_pattern("^[ ]*#[ ]*pragma[ ]+include[ ]*\\([ ]*[\\\"<](.*)[\\\">][ ]*\\).*");
@@ -147,12 +222,13 @@ void linkProgram(GLuint program)
 }
 
 ComputeProgram::ComputeProgram(std::string filename, std::vector<std::string> uniforms, std::unordered_map<std::string, TexBinding> texBindings,
-	std::unordered_map<std::string, ImgBinding> imgBindings)
+	std::unordered_map<std::string, ImgBinding> imgBindings, std::unordered_map<std::string, GLuint> bufBindings)
 	: mShader()
 	, mProgram()
 	, mUniformMap()
 	, mTexBindings(std::move(texBindings))
 	, mImgBindings(std::move(imgBindings))
+	, mBufBindings(std::move(bufBindings))
 {	
 	mShader = glCreateShader(GL_COMPUTE_SHADER);
 	mProgram = glCreateProgram();
@@ -202,18 +278,36 @@ void ComputeProgram::UpdateUniform(std::string name, const glm::vec3 value)
 	glUniform3fv(mUniformMap[name], 1, glm::value_ptr(value));
 }
 
+template<>
+void ComputeProgram::UpdateUniform(std::string name, const glm::ivec2 value)
+{
+	glUniform2iv(mUniformMap[name], 1, glm::value_ptr(value));
+}
+
 template<>
 void ComputeProgram::UpdateUniform(std::string name, const glm::ivec3 value)
 {
 	glUniform3iv(mUniformMap[name], 1, glm::value_ptr(value));
 }
 
+template<>
+void ComputeProgram::UpdateUniform(std::string name, const glm::mat3 value)
+{
+	glUniformMatrix3fv(mUniformMap[name], 1, GL_FALSE, glm::value_ptr(value));
+}
+
 template<>
 void ComputeProgram::UpdateUniform(std::string name, const glm::mat4 value)
 {
 	glUniformMatrix4fv(mUniformMap[name], 1, GL_FALSE, glm::value_ptr(value));
 }
 
+template<>
+void ComputeProgram::UpdateUniform(std::string name, const std::array<glm::vec4, 4> value)
+{
+	glUniform4fv(mUniformMap[name], GLsizei(value.size()), glm::value_ptr(value[0]));
+}
+
 void ComputeProgram::BindTexture(std::string name, GLuint tex)
 {
 	const TexBinding& bindInfo = mTexBindings.at(name);
@@ -227,7 +321,18 @@ void ComputeProgram::BindImage(std::string name, GLuint tex, GLuint level)
 	glBindImageTexture(bindInfo.binding, tex, level, GL_FALSE, 0, bindInfo.access, bindInfo.format);
 }
 
+void ComputeProgram::BindBuffer(std::string name, GLuint buffer)
+{
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, mBufBindings.at(name), buffer);
+}
+
 void ComputeProgram::Execute(GLuint x, GLuint y, GLuint z)
 {
 	glDispatchCompute(x, y, z);
+}
+
+void ComputeProgram::ExecuteIndirect(GLuint buffer, GLintptr offset)
+{
+	glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, buffer);
+	glDispatchComputeIndirect(offset);
 }
\ No newline at end of file
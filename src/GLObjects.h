@@ -1,5 +1,6 @@
 #pragma once
 
+#include <array>
 #include <string>
 #include <vector>
 #include <unordered_map>
@@ -44,6 +45,69 @@ private:
 	GLuint mTexture;
 };
 
+class UniqueBuffer
+{
+public:
+	UniqueBuffer() { glGenBuffers(1, &mBuffer); }
+	~UniqueBuffer() { glDeleteBuffers(1, &mBuffer); }
+
+	UniqueBuffer(const UniqueBuffer&) = delete;
+	UniqueBuffer& operator=(const UniqueBuffer&) = delete;
+
+	UniqueBuffer(UniqueBuffer&& other) noexcept
+	{
+		mBuffer = other.mBuffer;
+		other.mBuffer = 0;
+	}
+
+	GLuint Get() const { return mBuffer; }
+	void Swap(UniqueBuffer& other)
+	{
+		GLuint tempBuf = other.mBuffer;
+		other.mBuffer = mBuffer;
+		mBuffer = tempBuf;
+	}
+
+private:
+	GLuint mBuffer;
+};
+
+// Timestamp query pairs in a small ring so reading results back doesn't stall the pipeline,
+// results show up a few frames after the timed work was submitted
+class GpuTimer
+{
+public:
+	GpuTimer();
+	~GpuTimer();
+
+	GpuTimer(const GpuTimer&) = delete;
+	GpuTimer& operator=(const GpuTimer&) = delete;
+
+	void Begin();
+	void End();
+
+	// Average/last of the measurements that have come back since the last Reset, in milliseconds
+	double GetAverageMs() const { return mCount ? mTotalMs / double(mCount) : 0.0; }
+	double GetLastMs() const { return mLastMs; }
+	uint32_t GetCount() const { return mCount; }
+	void Reset();
+
+	// Blocks until everything timed so far has come back
+	void Flush();
+
+private:
+	static constexpr size_t RingSize = 4;
+
+	void Resolve(bool wait);
+
+	std::array<GLuint, RingSize * 2> mQueries;
+	size_t mNext;
+	size_t mPending;
+	double mTotalMs;
+	double mLastMs;
+	uint32_t mCount;
+};
+
 class Cubemap
 {
 public:
@@ -76,7 +140,7 @@ public:
 	};
 
 	ComputeProgram(std::string filename, std::vector<std::string> uniforms = {}, std::unordered_map<std::string, TexBinding> texBindings = {}, 
-		std::unordered_map<std::string, ImgBinding> imgBindings = {});
+		std::unordered_map<std::string, ImgBinding> imgBindings = {}, std::unordered_map<std::string, GLuint> bufBindings = {});
 	~ComputeProgram();
 
 	void Use();
@@ -88,12 +152,19 @@ public:
 
 	void BindImage(std::string name, GLuint tex, GLuint level = 0);
 
+	// shader storage buffers
+	void BindBuffer(std::string name, GLuint buffer);
+
 	void Execute(GLuint x, GLuint y, GLuint z);
 
+	// dispatch with the group counts stored at offset in buffer
+	void ExecuteIndirect(GLuint buffer, GLintptr offset = 0);
+
 private:
 	std::unordered_map<std::string, GLuint> mUniformMap;
 	std::unordered_map<std::string, TexBinding> mTexBindings;
 	std::unordered_map<std::string, ImgBinding> mImgBindings;
+	std::unordered_map<std::string, GLuint> mBufBindings;
 
 	GLuint mShader;
 	GLuint mProgram;
@@ -187,3 +187,32 @@ void SimpleTransferFunction::EvaluateColorTexture(const uint32_t size) const
 	glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
 	glTexImage1D(GL_TEXTURE_1D, 0, GL_RGBA32F, colors.size(), 0, GL_RGBA, GL_FLOAT, colors.data());
 }
+
+PreintegratedTable::PreintegratedTable()
+	: mProgram("shaders/preintegrate.glsl", { "tableSize" }, { {"opacityLUT", {GL_TEXTURE3, GL_TEXTURE_1D}} }, 
+		{ {"table", {0, GL_WRITE_ONLY, GL_RG32F}} })
+	, mUniqueTexture()
+	, mSize(0)
+{}
+
+void PreintegratedTable::EvaluateTexture(GLuint opacityLUT, const uint32_t size)
+{
+	if (size != mSize)
+	{
+		glBindTexture(GL_TEXTURE_2D, mUniqueTexture.Get());
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, size, size, 0, GL_RG, GL_FLOAT, nullptr);
+		mSize = size;
+	}
+
+	mProgram.Use();
+	mProgram.BindTexture("opacityLUT", opacityLUT);
+	mProgram.BindImage("table", mUniqueTexture.Get());
+	mProgram.UpdateUniform("tableSize", GLint(size));
+	mProgram.Execute((size + 15) / 16, (size + 15) / 16, 1);
+
+	glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+}
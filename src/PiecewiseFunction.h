@@ -37,6 +37,7 @@ public:
 		: mInterp()
 		, mKeys()
 		, mValues()
+		, mVersion(0)
 	{}
 
 	void AddStop(const K& k, const V& v)
@@ -47,14 +48,24 @@ public:
 		mValues.insert(std::next(std::begin(mValues), idx), v);
 	}
 
+	void ClearStops()
+	{
+		mKeys.clear();
+		mValues.clear();
+	}
+
 	void EvaluateTexture(const uint32_t size)
 	{
 		std::vector<V> evals = Evaluate(size);
 		GenTexture(evals);
+		mVersion++;
 	}
 
 	UniqueTexture& Unique() { return mUniqueTexture; }
 
+	// bumped every time the texture is re-evaluated, so passes that bake the lut know when to redo it
+	uint32_t Version() const { return mVersion; }
+
 private:
 
 	std::vector<V> Evaluate(const uint32_t size) const
@@ -84,6 +95,7 @@ private:
 	std::vector<K> mKeys;
 	std::vector<V> mValues;
 
+	uint32_t mVersion;
 };
 
 template<typename K, typename V>
@@ -152,3 +164,21 @@ private:
 	UniqueTexture mUniqueOpacityTexture;
 	UniqueTexture mUniqueColorTexture;
 };
+
+// 2D table of a 1D opacity lut integrated between a front and back density (see shaders/preintegrate.glsl), lets
+// the march use slab integrals instead of point samples so large steps don't alias high frequency transfer functions.
+// Works from the texture of any of the transfer functions above and is built on the gpu.
+class PreintegratedTable
+{
+public:
+	PreintegratedTable();
+
+	void EvaluateTexture(GLuint opacityLUT, const uint32_t size);
+
+	UniqueTexture& Unique() { return mUniqueTexture; }
+
+private:
+	ComputeProgram mProgram;
+	UniqueTexture mUniqueTexture;
+	uint32_t mSize;
+};
@@ -1,27 +1,154 @@
 #include "RaytracePass.h"
 
 #include <algorithm>
+#include <iostream>
+#include <limits>
 
 #include <glm/gtx/component_wise.hpp>
 
-RaytracePass::RaytracePass(const glm::ivec2& size, const uint32_t samples, std::shared_ptr<Dicom> dicom, GLuint transferLUT, GLuint opacityLUT)
-	: mRaytraceProgram("shaders/raymarch.glsl", { "numSamples", "scaleFactor", "scanSize", "scanResolution", "lowerBound", "view", "itrs", "depth" }, 
-		{ {"rawVolume", {GL_TEXTURE1, GL_TEXTURE_3D}}, {"transferLUT", {GL_TEXTURE2, GL_TEXTURE_1D}}, {"opacityLUT", {GL_TEXTURE3, GL_TEXTURE_1D}}, {"cubemap", {GL_TEXTURE4, GL_TEXTURE_CUBE_MAP}}, {"clearcoatLUT", {GL_TEXTURE7, GL_TEXTURE_1D}} },
-		{ {"imgOutput", {0, GL_READ_WRITE, GL_RGBA16F}}, {"rayPosTex", {5, GL_READ_WRITE, GL_RGBA16F}}, {"accumTex", {6, GL_READ_WRITE, GL_RGBA16F}} })
-	, mGenRaysProgram("shaders/gen_rays.glsl", { "numSamples", "view", "itrs" }, {},
-		{ {"imgOutput", {0, GL_READ_WRITE, GL_RGBA16F}}, {"rayPosTex", {5, GL_READ_WRITE, GL_RGBA16F}}, {"accumTex", {6, GL_READ_WRITE, GL_RGBA16F}} })
+namespace
+{
+	constexpr size_t svoNodeSize = 6 * sizeof(GLuint); // SvoNode in svo.glsl
+
+	GLuint numGroups(int size, int groupSize)
+	{
+		return GLuint((size + groupSize - 1) / groupSize);
+	}
+
+	// Largest bake with the scan's physical aspect ratio, so baked voxels stay roughly cubic, that doesn't go past 
+	// the scan's resolution and fits in the budget along with its mip chain
+	glm::ivec3 calcBakeSize(const glm::ivec3& scanSize, glm::vec3 physicalSize, float budgetMB, bool anisotropic)
+	{
+		if (glm::compMin(physicalSize) <= 0.f)
+		{
+			physicalSize = glm::vec3(scanSize); // no spacing info, assume cubic scan voxels
+		}
+
+		const glm::vec3 aspect = physicalSize / glm::compMax(physicalSize);
+		const double bytesPerVoxel = (anisotropic ? 16.0 : 8.0) * 8.0 / 7.0; // rgba16 (and the rgba16 directional opacity) plus mips
+		const double budgetBytes = double(budgetMB) * 1024.0 * 1024.0;
+
+		glm::ivec3 bakeSize = glm::ivec3(1);
+		for (int res = glm::compMax(scanSize); res > 0; res--)
+		{
+			bakeSize = glm::clamp(glm::ivec3(glm::round(aspect * float(res))), glm::ivec3(1), scanSize);
+			if (double(bakeSize.x) * double(bakeSize.y) * double(bakeSize.z) * bytesPerVoxel <= budgetBytes)
+			{
+				break;
+			}
+		}
+
+		return bakeSize;
+	}
+}
+
+RaytracePass::RaytracePass(const glm::ivec2& size, const uint32_t samples, std::shared_ptr<Dicom> dicom, GLuint transferLUT, GLuint opacityLUT, 
+	const RaytraceSettings& settings)
+	: mRaytraceProgram("shaders/raymarch.glsl", { "numSamples", "scaleFactor", "scanSize", "scanResolution", "lowerBound", "view", "itrs", "depth", 
+		"coarseStepScale", "refineSteps", "classification", "precomputedGradient", "envRotation", "lightPositions", "lightColors", "numLights", 
+		"multipleScattering", "msRadius", "msBakeLevel", "wavefront", "adaptive", "activeSamples", "renderSize", "reproject", 
+		"prevActiveSamples", "maxHistory", "entryCache", "screenRectMin", "screenRectMax", "persistent", "gridGroups", "schedulerStats" }, 
+		{ {"rawVolume", {GL_TEXTURE1, GL_TEXTURE_3D}}, {"transferLUT", {GL_TEXTURE2, GL_TEXTURE_1D}}, {"opacityLUT", {GL_TEXTURE3, GL_TEXTURE_1D}}, {"cubemap", {GL_TEXTURE4, GL_TEXTURE_CUBE_MAP}}, {"clearcoatLUT", {GL_TEXTURE7, GL_TEXTURE_1D}},
+		{"classifiedVolume", {GL_TEXTURE8, GL_TEXTURE_3D}}, {"preintegratedTable", {GL_TEXTURE9, GL_TEXTURE_2D}},
+		{"gradientVolume", {GL_TEXTURE10, GL_TEXTURE_3D}}, {"lightVolume", {GL_TEXTURE11, GL_TEXTURE_3D}}, {"msLUT", {GL_TEXTURE12, GL_TEXTURE_2D}},
+		{"bakedVolume", {GL_TEXTURE13, GL_TEXTURE_3D}}, {"historyTex", {GL_TEXTURE15, GL_TEXTURE_2D}} },
+		{ {"imgOutput", {0, GL_READ_WRITE, GL_RGBA16F}}, {"rayPosTex", {5, GL_READ_WRITE, GL_RGBA16F}}, {"accumTex", {6, GL_READ_WRITE, GL_RGBA16F}},
+		{"lightTex", {7, GL_READ_WRITE, GL_RGBA16F}}, {"weightTex", {1, GL_READ_WRITE, GL_R32F}}, {"reprojectTex", {2, GL_READ_ONLY, GL_RGBA32F}},
+		{"entryTex", {3, GL_READ_ONLY, GL_R32F}} },
+		{ {"traceQueue", 3}, {"directQueue", 4}, {"tileQueue", 5}, {"rayScheduler", 6} })
+	, mGenRaysProgram("shaders/gen_rays.glsl", { "numSamples", "view", "itrs", "wavefront", "lowerBound", "envRotation", "adaptive", "activeSamples", "renderSize", "entryCache", "screenRectMin", "screenRectMax" }, 
+		{ {"cubemap", {GL_TEXTURE4, GL_TEXTURE_CUBE_MAP}} },
+		{ {"imgOutput", {0, GL_READ_WRITE, GL_RGBA16F}}, {"rayPosTex", {5, GL_READ_WRITE, GL_RGBA16F}}, {"accumTex", {6, GL_READ_WRITE, GL_RGBA16F}},
+		{"entryTex", {3, GL_READ_ONLY, GL_R32F}} },
+		{ {"traceQueue", 3}, {"tileQueue", 5} })
 	, mDenoiseProgram("shaders/denoise.glsl", {}) // TODO: add texture/image bindings
-	, mPrecomputeProgram("shaders/precompute.glsl", { "scanResolution" }, 
+	, mPrecomputeProgram("shaders/precompute.glsl", { "scanResolution", "bakeResolution", "sliceOffset" }, 
 		{ { "transferLUT", {GL_TEXTURE2, GL_TEXTURE_1D} }, { "opacityLUT", {GL_TEXTURE3, GL_TEXTURE_1D} } },
 		{ {"rawVolume", {1, GL_READ_ONLY, GL_R16}} , {"bakedVolume", {4, GL_WRITE_ONLY, GL_RGBA16}} })
-	, mConeTraceProgram("shaders/raymarch_direct.glsl", { "numSamples", "scaleFactor", "lowerBound", "itrs" }, 
-		{ {"sigmaVolume", {GL_TEXTURE3, GL_TEXTURE_3D}}, {"cubemap", {GL_TEXTURE4, GL_TEXTURE_CUBE_MAP}}, {"clearcoatLUT", {GL_TEXTURE7, GL_TEXTURE_1D}} },
-		{ {"imgOutput", {0, GL_READ_WRITE, GL_RGBA16F}}, {"rayPosTex", {5, GL_READ_WRITE, GL_RGBA16F}}, {"accumTex", {6, GL_READ_WRITE, GL_RGBA16F}} })
+	, mConeTraceProgram("shaders/raymarch_direct.glsl", { "numSamples", "scaleFactor", "lowerBound", "itrs", "bakeLodBias", "anisotropic", 
+		"coneStepScale", "svoDepth", "svoScale", "svoLevelBias", "summedAreaTable", "bakeResolution", "radianceCache", "radianceCacheSamples", 
+		"prt", "envRotation", "numLights", "wavefront", "adaptive", "activeSamples", "renderSize", "screenRectMin", "screenRectMax", "depth" }, 
+		{ {"sigmaVolume", {GL_TEXTURE3, GL_TEXTURE_3D}}, {"cubemap", {GL_TEXTURE4, GL_TEXTURE_CUBE_MAP}}, {"clearcoatLUT", {GL_TEXTURE7, GL_TEXTURE_1D}},
+		{"anisoVolume", {GL_TEXTURE8, GL_TEXTURE_3D}}, {"satVolume", {GL_TEXTURE9, GL_TEXTURE_3D}},
+		{"radianceCacheR", {GL_TEXTURE10, GL_TEXTURE_3D}}, {"radianceCacheG", {GL_TEXTURE11, GL_TEXTURE_3D}}, {"radianceCacheB", {GL_TEXTURE12, GL_TEXTURE_3D}},
+		{"radianceCacheCount", {GL_TEXTURE13, GL_TEXTURE_3D}}, {"prtVolume", {GL_TEXTURE14, GL_TEXTURE_3D}} },
+		{ {"imgOutput", {0, GL_READ_WRITE, GL_RGBA16F}}, {"rayPosTex", {5, GL_READ_WRITE, GL_RGBA16F}}, {"accumTex", {6, GL_READ_WRITE, GL_RGBA16F}},
+		{"lightTex", {7, GL_READ_WRITE, GL_RGBA16F}}, {"weightTex", {1, GL_READ_WRITE, GL_R32F}} },
+		{ {"svoNodes", 0}, {"envSh", 2}, {"directQueue", 4}, {"tileQueue", 5} })
+	, mClassifyProgram("shaders/classify.glsl", { "scanResolution" },
+		{ {"rawVolume", {GL_TEXTURE1, GL_TEXTURE_3D}}, {"transferLUT", {GL_TEXTURE2, GL_TEXTURE_1D}}, {"opacityLUT", {GL_TEXTURE3, GL_TEXTURE_1D}} },
+		{ {"classifiedVolume", {4, GL_WRITE_ONLY, settings.preclassifiedFormat}} })
+	, mGradientProgram("shaders/gradient.glsl", { "scanResolution", "kernel" }, { {"rawVolume", {GL_TEXTURE1, GL_TEXTURE_3D}} },
+		{ {"gradientVolume", {4, GL_WRITE_ONLY, settings.gradientFormat}} })
+	, mMipmapProgram("shaders/mipmap.glsl", { "srcResolution", "numLevels", "reduction" }, {},
+		{ {"srcLevel", {1, GL_READ_ONLY, GL_RGBA16}}, {"dstLevel1", {2, GL_WRITE_ONLY, GL_RGBA16}}, {"dstLevel2", {3, GL_WRITE_ONLY, GL_RGBA16}},
+		{"dstLevel3", {4, GL_WRITE_ONLY, GL_RGBA16}} })
+	, mAnisoMipmapProgram("shaders/mipmap_aniso.glsl", { "srcResolution", "dstResolution", "fromBake" }, {},
+		{ {"srcLevel", {1, GL_READ_ONLY, GL_RGBA16}}, {"dstLevel", {2, GL_WRITE_ONLY, GL_RGBA16}} })
+	, mSvoBuildProgram("shaders/svo_build.glsl", { "levelStart", "levelCount", "depth", "svoDepth", "maxNodes", "scanResolution", "bakeLevelBias", 
+		"subdivideOpacity" },
+		{ {"rawVolume", {GL_TEXTURE1, GL_TEXTURE_3D}}, {"transferLUT", {GL_TEXTURE2, GL_TEXTURE_1D}}, {"opacityLUT", {GL_TEXTURE3, GL_TEXTURE_1D}},
+		{"bakedVolume", {GL_TEXTURE4, GL_TEXTURE_3D}} }, {},
+		{ {"svoNodes", 0}, {"svoCounter", 1} })
+	, mSatScanProgram("shaders/sat_scan.glsl", { "resolution", "axis", "fromBake" }, { {"bakedVolume", {GL_TEXTURE1, GL_TEXTURE_3D}} },
+		{ {"sat", {2, GL_READ_WRITE, settings.summedAreaTable == RaytraceSettings::SummedAreaTable::Split ? GLenum(GL_RG32F) : GLenum(GL_R32F)}} })
+	, mRadianceCacheProgram("shaders/radiance_cache.glsl", { "cacheResolution", "firstSlice", "numSlices", "raysPerProbe", "targetSamples", "update", 
+		"bakeLodBias", "envRotation" },
+		{ {"sigmaVolume", {GL_TEXTURE3, GL_TEXTURE_3D}}, {"cubemap", {GL_TEXTURE4, GL_TEXTURE_CUBE_MAP}} },
+		{ {"cacheR", {1, GL_READ_WRITE, GL_RGBA32F}}, {"cacheG", {2, GL_READ_WRITE, GL_RGBA32F}}, {"cacheB", {3, GL_READ_WRITE, GL_RGBA32F}},
+		{"cacheCount", {4, GL_READ_WRITE, GL_R32F}} })
+	, mPrtProgram("shaders/prt.glsl", { "prtResolution", "firstSlice", "numSlices", "numRays", "bakeLodBias" }, { {"sigmaVolume", {GL_TEXTURE3, GL_TEXTURE_3D}} },
+		{ {"prtVolume", {1, GL_WRITE_ONLY, GL_RGBA16F}} })
+	, mEnvShProgram("shaders/env_sh.glsl", { "samplesPerInvocation" }, { {"cubemap", {GL_TEXTURE4, GL_TEXTURE_CUBE_MAP}} }, {},
+		{ {"envSh", 2} })
+	, mLightVolumeProgram("shaders/light_volume.glsl", { "lightResolution", "lightPositions", "numLights", "bakeLevel" },
+		{ {"sigmaVolume", {GL_TEXTURE3, GL_TEXTURE_3D}} }, { {"lightVolume", {1, GL_WRITE_ONLY, GL_RGBA16F}} })
+	, mMultipleScatteringProgram("shaders/multiscatter_lut.glsl", { "lutResolution", "numWalks" }, {},
+		{ {"msLUT", {1, GL_WRITE_ONLY, GL_RG16F}} })
+	, mQueueArgsProgram("shaders/queue_args.glsl", { "itemsPerGroup", "groupsPerItem" }, {}, {}, { {"queue", 3} })
+	, mTileErrorProgram("shaders/tile_error.glsl", { "numSamples", "activeSamples", "renderSize", "itrs", "minItrs", "threshold" }, {},
+		{ {"imgOutput", {0, GL_READ_ONLY, GL_RGBA16F}} }, { {"tileQueue", 5} })
+	, mEntryCacheProgram("shaders/entry_cache.glsl", { "view", "renderSize", "lowerBound", "scaleFactor", "level", "cellSize" },
+		{ {"bakedVolume", {GL_TEXTURE1, GL_TEXTURE_3D}} }, { {"entryTex", {0, GL_WRITE_ONLY, GL_R32F}} })
+	, mEnvFillProgram("shaders/env_fill.glsl", { "numSamples", "view", "envRotation", "renderSize", "screenRectMin", "screenRectMax" },
+		{ {"cubemap", {GL_TEXTURE4, GL_TEXTURE_CUBE_MAP}} },
+		{ {"imgOutput", {0, GL_WRITE_ONLY, GL_RGBA16F}}, {"accumTex", {6, GL_WRITE_ONLY, GL_RGBA16F}} })
+	, mFirstHitProgram("shaders/first_hit.glsl", { "view", "renderSize", "lowerBound", "scaleFactor", "bakeResolution", "reproject", 
+		"prevInvView", "prevRenderSize" }, { {"bakedVolume", {GL_TEXTURE1, GL_TEXTURE_3D}}, {"historyGBuffer", {GL_TEXTURE2, GL_TEXTURE_2D}} },
+		{ {"gbufferTex", {0, GL_WRITE_ONLY, GL_RGBA32UI}}, {"reprojectTex", {1, GL_WRITE_ONLY, GL_RGBA32F}} })
 	, mSize(size)
+	, mRenderSize(size)
+	, mScreenRectMin(0)
+	, mScreenRectMax(size)
 	, mNumSamples(samples)
+	, mActiveSamples(samples)
+	, mStepScale(1.f)
 	, mDicom(dicom)
+	, mSettings(settings)
+	, mBakeSize()
+	, mBakeLevels(1)
+	, mTransferFunctionVersion(0)
+	, mBakedVersion(0)
+	, mRebakeSlice(0)
+	, mSvoDepth(0)
+	, mRadianceCacheSlice(0)
+	, mRadianceCacheSlabRays(0)
+	, mRadianceCacheUpdates(0)
+	, mPrtSlice(0)
+	, mEnvShCubemap(0)
+	, mEnvRotation(1.f)
+	, mLightPositions()
+	, mLightColors()
+	, mNumLights(0)
+	, mLightsDirty(false)
+	, mLightVolumeBuilt(false)
 	, mPhysicalSize()
 	, mItrs(1)
+	, mConvergedItrs(0)
+	, mLastView(1.f)
+	, mLastRenderSize(size)
+	, mLastActiveSamples(samples)
+	, mHistoryValid(false)
 {
 	glActiveTexture(GL_TEXTURE0);
 	glBindTexture(GL_TEXTURE_2D, mDenoiseTexture.Get());
@@ -51,36 +178,841 @@ RaytracePass::RaytracePass(const glm::ivec2& size, const uint32_t samples, std::
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, size.x * samples, size.y, 0, GL_RGBA, GL_HALF_FLOAT, nullptr);
 	glBindImageTexture(6, mAccumTexture.Get(), 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA16F);
 
+	glBindTexture(GL_TEXTURE_2D, mLightTexture.Get());
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, size.x * samples, size.y, 0, GL_RGBA, GL_HALF_FLOAT, nullptr);
+
+	glBindTexture(GL_TEXTURE_2D, mWeightTexture.Get());
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, size.x * samples, size.y, 0, GL_RED, GL_FLOAT, nullptr);
+
+	if (mSettings.temporalReuse)
+	{
+		// history has to be read with texelFetch, so no filtering or mips
+		for (UniqueTexture* texture : { &mGBufferTexture, &mHistoryGBufferTexture })
+		{
+			glBindTexture(GL_TEXTURE_2D, texture->Get());
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32UI, size.x, size.y, 0, GL_RGBA_INTEGER, GL_UNSIGNED_INT, nullptr);
+		}
+
+		glBindTexture(GL_TEXTURE_2D, mReprojectTexture.Get());
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, size.x, size.y, 0, GL_RGBA, GL_FLOAT, nullptr);
+
+		glBindTexture(GL_TEXTURE_2D, mHistoryTexture.Get());
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, size.x * samples, size.y, 0, GL_RGBA, GL_HALF_FLOAT, nullptr);
+	}
+
+	if (mSettings.entryCache)
+	{
+		glBindTexture(GL_TEXTURE_2D, mEntryTexture.Get());
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, size.x, size.y, 0, GL_RED, GL_FLOAT, nullptr);
+	}
+
+	if (mSettings.adaptiveSampling)
+	{
+		// same header as the ray queues, then a tile per 16x16 screen pixels
+		const GLsizeiptr tileBytes = 4 * sizeof(GLuint) + GLsizeiptr((size.x + 15) / 16) * ((size.y + 15) / 16) * sizeof(GLuint);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, mTileQueueBuffer.Get());
+		glBufferData(GL_SHADER_STORAGE_BUFFER, tileBytes, nullptr, GL_DYNAMIC_COPY);
+	}
+
+	if (mSettings.wavefront)
+	{
+		// header of uvec3 dispatch args and a count, then a pixel per sample
+		const GLsizeiptr queueBytes = 4 * sizeof(GLuint) + GLsizeiptr(size.x) * samples * size.y * sizeof(GLuint);
+		for (UniqueBuffer* queue : { &mTraceQueueBuffer, &mDirectQueueBuffer })
+		{
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, queue->Get());
+			glBufferData(GL_SHADER_STORAGE_BUFFER, queueBytes, nullptr, GL_DYNAMIC_COPY);
+		}
+	}
+
+	if (mSettings.persistentThreads || mSettings.schedulerStats)
+	{
+		// the next ray, then (lo, hi) of the steps marched and of the steps resident, see persistent.glsl
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, mRaySchedulerBuffer.Get());
+		glBufferData(GL_SHADER_STORAGE_BUFFER, 5 * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+	}
+
 	mView = glm::mat4(1.f);
 	mLowerBound = glm::vec3(0.f);
 	mScaleFactor = glm::vec3(0.f);
 
 	glm::ivec3 dicomDim = mDicom.lock()->GetScanSize();
-	GLint lodLevels = 1 + std::floor(std::log2(glm::compMax(dicomDim)));
 
-	const glm::ivec3 bakeSize = glm::ivec3(128);
+	const glm::ivec3 bakeSize = calcBakeSize(dicomDim, mDicom.lock()->GetPhysicalSize(), mSettings.bakeBudgetMB, mSettings.anisotropic);
+	mBakeSize = bakeSize;
+	mBakeLevels = 1 + GLint(std::floor(std::log2(glm::compMax(bakeSize))));
+
 	glBindTexture(GL_TEXTURE_3D, mBakedVolumeTexture.Get());
 	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
 	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
 	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_BORDER);
-	glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA16, bakeSize.x, bakeSize.y, bakeSize.z, 0, GL_RGBA, GL_UNSIGNED_SHORT, nullptr);
-	glGenerateTextureMipmap(mBakedVolumeTexture.Get()); // For some reason I have to do this twice or there is a crash later
+	glTexStorage3D(GL_TEXTURE_3D, mBakeLevels, GL_RGBA16, bakeSize.x, bakeSize.y, bakeSize.z);
+
+	if (mSettings.anisotropic)
+	{
+		glBindTexture(GL_TEXTURE_3D, mAnisoVolumeTexture.Get());
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_BORDER);
+		glTexStorage3D(GL_TEXTURE_3D, mBakeLevels, GL_RGBA16, bakeSize.x, bakeSize.y, bakeSize.z);
+	}
+
+	Bake(transferLUT, opacityLUT, 0, bakeSize.z);
+	mRebakeSlice = bakeSize.z;
+	BuildMips();
+	mBakeTimer.Flush();
+	mMipTimer.Flush();
+	std::cout << "baked volume: " << bakeSize.x << "x" << bakeSize.y << "x" << bakeSize.z << " in " << mBakeTimer.GetLastMs() << " ms, " 
+		<< mBakeLevels << " mips in " << mMipTimer.GetLastMs() << " ms\n";
+
+	if (mSettings.summedAreaTable != RaytraceSettings::SummedAreaTable::Off)
+	{
+		// queries fetch one texel per corner of a voxel aligned box, see sat.glsl
+		const GLenum satFormat = mSettings.summedAreaTable == RaytraceSettings::SummedAreaTable::Split ? GL_RG32F : GL_R32F;
+		glBindTexture(GL_TEXTURE_3D, mSatVolumeTexture.Get());
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexStorage3D(GL_TEXTURE_3D, 1, satFormat, bakeSize.x, bakeSize.y, bakeSize.z);
+
+		BuildSummedAreaTable(true);
+	}
+
+	if (mSettings.radianceCache)
+	{
+		const GLsizei cacheSize = GLsizei(mSettings.radianceCacheSize);
+		for (UniqueTexture* texture : { &mRadianceCacheTextures[0], &mRadianceCacheTextures[1], &mRadianceCacheTextures[2], &mRadianceCacheCountTexture })
+		{
+			glBindTexture(GL_TEXTURE_3D, texture->Get());
+			glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+			glTexStorage3D(GL_TEXTURE_3D, 1, texture == &mRadianceCacheCountTexture ? GL_R32F : GL_RGBA32F, cacheSize, cacheSize, cacheSize);
+		}
+
+		ResetRadianceCache();
+	}
 
-	// create the baked volume texture containing (rgb transfer lut color, transfer lut opacity * density)
+	if (mSettings.prt)
+	{
+		const GLsizei prtSize = GLsizei(mSettings.prtSize);
+		glBindTexture(GL_TEXTURE_3D, mPrtVolumeTexture.Get());
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+		glTexStorage3D(GL_TEXTURE_3D, 1, GL_RGBA16F, prtSize, prtSize, prtSize);
+
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, mEnvShBuffer.Get());
+		glBufferData(GL_SHADER_STORAGE_BUFFER, 3 * 4 * sizeof(float), nullptr, GL_DYNAMIC_DRAW);
+
+		BuildPrt(0, prtSize);
+		mPrtSlice = prtSize;
+	}
+
+	// the light volume is filled by the first Execute after SetLights, nothing reads it while there are no lights
+	const GLsizei lightVolumeSize = GLsizei(mSettings.lightVolumeSize);
+	glBindTexture(GL_TEXTURE_3D, mLightVolumeTexture.Get());
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	glTexStorage3D(GL_TEXTURE_3D, 1, GL_RGBA16F, lightVolumeSize, lightVolumeSize, lightVolumeSize);
+
+	if (mSettings.multipleScattering)
+	{
+		BuildMultipleScatteringLUT();
+	}
+
+	if (mSettings.svo)
+	{
+		// the octree is a power of 2 cube around the scan, node coordinates have room for 2^15 nodes per axis
+		mSvoDepth = GLuint(std::min(std::ceil(std::log2(float(glm::compMax(dicomDim)))), 15.f));
+
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, mSvoNodeBuffer.Get());
+		glBufferData(GL_SHADER_STORAGE_BUFFER, GLsizeiptr(mSettings.svoMaxNodes) * svoNodeSize, nullptr, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, mSvoCounterBuffer.Get());
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint), nullptr, GL_DYNAMIC_READ);
+
+		BuildSvo(transferLUT, opacityLUT, true);
+	}
+
+	if (mSettings.classification == RaytraceSettings::Classification::Pre)
+	{
+		glBindTexture(GL_TEXTURE_3D, mClassifiedVolumeTexture.Get());
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_BORDER);
+		glTexStorage3D(GL_TEXTURE_3D, 1, mSettings.preclassifiedFormat, dicomDim.x, dicomDim.y, dicomDim.z);
+
+		const size_t bytesPerVoxel = mSettings.preclassifiedFormat == GL_RGBA16 ? 8 : 4;
+		std::cout << "pre-classified volume: " << (size_t(dicomDim.x) * dicomDim.y * dicomDim.z * bytesPerVoxel) / (1024 * 1024) << " MB\n";
+
+		Preclassify(transferLUT, opacityLUT);
+	}
+
+	if (mSettings.classification == RaytraceSettings::Classification::PreIntegrated)
+	{
+		mPreintegratedTable.EvaluateTexture(opacityLUT, mSettings.preintegratedSize);
+	}
+
+	if (mSettings.gradient != RaytraceSettings::Gradient::Runtime)
+	{
+		glBindTexture(GL_TEXTURE_3D, mGradientVolumeTexture.Get());
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+		glTexStorage3D(GL_TEXTURE_3D, 1, mSettings.gradientFormat, dicomDim.x, dicomDim.y, dicomDim.z);
+
+		PrecomputeGradient();
+	}
+}
+
+void RaytracePass::Bake(GLuint transferLUT, GLuint opacityLUT, GLint firstSlice, GLint numSlices)
+{
+	// create the baked volume texture containing (rgb transfer lut color, transfer lut opacity)
+	mBakeTimer.Begin();
 	mPrecomputeProgram.Use();
 	mPrecomputeProgram.BindTexture("transferLUT", transferLUT);
 	mPrecomputeProgram.BindTexture("opacityLUT", opacityLUT);
-	mPrecomputeProgram.BindImage("rawVolume", dicom->GetTexture().Get(), 0);
+	mPrecomputeProgram.BindImage("rawVolume", mDicom.lock()->GetTexture().Get(), 0);
 	mPrecomputeProgram.BindImage("bakedVolume", mBakedVolumeTexture.Get(), 0);
-	mPrecomputeProgram.UpdateUniform("scanResolution", dicom->GetScanSize());
-	mPrecomputeProgram.Execute(bakeSize.x / 8, bakeSize.y / 8, bakeSize.z / 8);
+	mPrecomputeProgram.UpdateUniform("scanResolution", mDicom.lock()->GetScanSize());
+	mPrecomputeProgram.UpdateUniform("bakeResolution", mBakeSize);
+	mPrecomputeProgram.UpdateUniform("sliceOffset", firstSlice);
+	mPrecomputeProgram.Execute(numGroups(mBakeSize.x, 16), numGroups(mBakeSize.y, 16), numSlices);
+	mBakeTimer.End();
+
+	glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+}
+
+void RaytracePass::UpdateBake(GLuint transferLUT, GLuint opacityLUT)
+{
+	if (mTransferFunctionVersion != mBakedVersion)
+	{
+		// a change in the middle of a re-bake starts it over so every slab is baked from the same luts
+		mBakedVersion = mTransferFunctionVersion;
+		mRebakeSlice = 0;
+		mItrs = 1;
+		mHistoryValid = false;
+	}
+
+	if (mRebakeSlice >= mBakeSize.z)
+	{
+		// the transfer volume cone traces the finished mips, so it follows the bake over as many frames again
+		const GLint prtSize = GLint(mSettings.prtSize);
+		if (mSettings.prt && mPrtSlice < prtSize)
+		{
+			const GLint frames = GLint(std::max(mSettings.rebakeFrames, 1u));
+			const GLint numSlices = std::min((prtSize + frames - 1) / frames, prtSize - mPrtSlice);
+			BuildPrt(mPrtSlice, numSlices);
+			mPrtSlice += numSlices;
+			if (mPrtSlice >= prtSize)
+			{
+				mItrs = 1;
+				mHistoryValid = false;
+			}
+		}
+		return;
+	}
+
+	// the bake is redone in place, the frames in between cone trace a partly updated volume but they're thrown away
+	// when accumulation restarts below
+	const GLint frames = GLint(std::max(mSettings.rebakeFrames, 1u));
+	const GLint numSlices = std::min((mBakeSize.z + frames - 1) / frames, mBakeSize.z - mRebakeSlice);
+	Bake(transferLUT, opacityLUT, mRebakeSlice, numSlices);
+	mRebakeSlice += numSlices;
+
+	if (mRebakeSlice < mBakeSize.z)
+	{
+		return;
+	}
+
+	BuildMips();
+
+	if (mSettings.summedAreaTable != RaytraceSettings::SummedAreaTable::Off)
+	{
+		BuildSummedAreaTable(false);
+	}
+
+	if (mSettings.radianceCache)
+	{
+		ResetRadianceCache();
+	}
+
+	if (mSettings.prt)
+	{
+		mPrtSlice = 0;
+	}
+
+	if (mSettings.svo)
+	{
+		BuildSvo(transferLUT, opacityLUT, false);
+	}
+
+	mLightsDirty = true;
+
+	if (mSettings.classification == RaytraceSettings::Classification::Pre)
+	{
+		Preclassify(transferLUT, opacityLUT);
+	}
+
+	if (mSettings.classification == RaytraceSettings::Classification::PreIntegrated)
+	{
+		mPreintegratedTable.EvaluateTexture(opacityLUT, mSettings.preintegratedSize);
+	}
+
+	mItrs = 1;
+	mHistoryValid = false;
+}
+
+void RaytracePass::BuildMips()
+{
+	// each dispatch reduces a level into the next 3 through shared memory, so a 256^3 bake takes 3 dispatches. A 
+	// workgroup can only reduce the block it loaded itself, and an 8^3 block is the largest that fits: a 4th level 
+	// would need 16^3 = 4096 invocations, past GL's guaranteed 1024 per workgroup, and 80KB of shared memory, past the 
+	// guaranteed 32KB. The levels past the first 3 read the previous dispatch's output after the barrier instead
+	mMipTimer.Begin();
+	mMipmapProgram.Use();
+	mMipmapProgram.UpdateUniform("reduction", GLuint(mSettings.mipReduction));
+	for (GLint level = 0; level + 1 < mBakeLevels; level += 3)
+	{
+		const glm::ivec3 srcSize = glm::max(mBakeSize >> level, glm::ivec3(1));
+		const GLint numLevels = std::min(3, mBakeLevels - 1 - level);
+
+		// levels past the end of the chain are never written, they're bound to the last level to keep the bindings valid
+		mMipmapProgram.BindImage("srcLevel", mBakedVolumeTexture.Get(), level);
+		mMipmapProgram.BindImage("dstLevel1", mBakedVolumeTexture.Get(), std::min(level + 1, mBakeLevels - 1));
+		mMipmapProgram.BindImage("dstLevel2", mBakedVolumeTexture.Get(), std::min(level + 2, mBakeLevels - 1));
+		mMipmapProgram.BindImage("dstLevel3", mBakedVolumeTexture.Get(), std::min(level + 3, mBakeLevels - 1));
+		mMipmapProgram.UpdateUniform("srcResolution", srcSize);
+		mMipmapProgram.UpdateUniform("numLevels", numLevels);
+		mMipmapProgram.Execute(numGroups(srcSize.x, 8), numGroups(srcSize.y, 8), numGroups(srcSize.z, 8));
+
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+	}
+
+	if (mSettings.anisotropic)
+	{
+		BuildAnisotropicMips();
+	}
+	mMipTimer.End();
+
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+}
+
+void RaytracePass::BuildAnisotropicMips()
+{
+	// one level per dispatch, every level composites the one before it
+	mAnisoMipmapProgram.Use();
+	for (GLint level = 0; level < mBakeLevels; level++)
+	{
+		const glm::ivec3 srcSize = glm::max(mBakeSize >> std::max(level - 1, 0), glm::ivec3(1));
+		const glm::ivec3 dstSize = glm::max(mBakeSize >> level, glm::ivec3(1));
+
+		mAnisoMipmapProgram.BindImage("srcLevel", level == 0 ? mBakedVolumeTexture.Get() : mAnisoVolumeTexture.Get(), std::max(level - 1, 0));
+		mAnisoMipmapProgram.BindImage("dstLevel", mAnisoVolumeTexture.Get(), level);
+		mAnisoMipmapProgram.UpdateUniform("srcResolution", srcSize);
+		mAnisoMipmapProgram.UpdateUniform("dstResolution", dstSize);
+		mAnisoMipmapProgram.UpdateUniform("fromBake", GLuint(level == 0));
+		mAnisoMipmapProgram.Execute(numGroups(dstSize.x, 4), numGroups(dstSize.y, 4), numGroups(dstSize.z, 4));
+
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+	}
+}
+
+void RaytracePass::BuildSvo(GLuint transferLUT, GLuint opacityLUT, bool logStats)
+{
+	const glm::ivec3 scanSize = mDicom.lock()->GetScanSize();
+
+	// start from just the root, every level adds the children of the one before it
+	const std::array<GLuint, svoNodeSize / sizeof(GLuint)> root = {};
+	const GLuint rootCount = 1;
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, mSvoNodeBuffer.Get());
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(root), root.data());
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, mSvoCounterBuffer.Get());
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(rootCount), &rootCount);
+
+	GpuTimer timer;
+	timer.Begin();
+	mSvoBuildProgram.Use();
+	mSvoBuildProgram.BindTexture("rawVolume", mDicom.lock()->GetTexture().Get());
+	mSvoBuildProgram.BindTexture("transferLUT", transferLUT);
+	mSvoBuildProgram.BindTexture("opacityLUT", opacityLUT);
+	mSvoBuildProgram.BindTexture("bakedVolume", mBakedVolumeTexture.Get());
+	mSvoBuildProgram.BindBuffer("svoNodes", mSvoNodeBuffer.Get());
+	mSvoBuildProgram.BindBuffer("svoCounter", mSvoCounterBuffer.Get());
+	mSvoBuildProgram.UpdateUniform("svoDepth", mSvoDepth);
+	mSvoBuildProgram.UpdateUniform("maxNodes", GLuint(mSettings.svoMaxNodes));
+	mSvoBuildProgram.UpdateUniform("scanResolution", scanSize);
+	mSvoBuildProgram.UpdateUniform("bakeLevelBias", std::log2(float(glm::compMax(scanSize)) / glm::compMax(mBakeSize)));
+	mSvoBuildProgram.UpdateUniform("subdivideOpacity", mSettings.svoSubdivideOpacity);
+
+	GLuint levelStart = 0, levelEnd = 1;
+	for (GLuint depth = 0; depth <= mSvoDepth && levelStart < levelEnd; depth++)
+	{
+		mSvoBuildProgram.UpdateUniform("levelStart", levelStart);
+		mSvoBuildProgram.UpdateUniform("levelCount", levelEnd - levelStart);
+		mSvoBuildProgram.UpdateUniform("depth", depth);
+		mSvoBuildProgram.Execute(numGroups(levelEnd - levelStart, 64), 1, 1);
+
+		// the next level's size is read back to size its dispatch, the build only runs when the luts change
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+		GLuint nodeCount = 0;
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, mSvoCounterBuffer.Get());
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(nodeCount), &nodeCount);
+
+		levelStart = levelEnd;
+		levelEnd = std::min(nodeCount, GLuint(mSettings.svoMaxNodes));
+	}
+	timer.End();
+
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	// re-bakes rebuild it after every transfer function edit, those aren't worth a line each
+	if (!logStats)
+	{
+		return;
+	}
+
+	timer.Flush();
+	std::cout << "sparse voxel octree: " << levelEnd << " nodes, " << (size_t(levelEnd) * svoNodeSize) / (1024 * 1024) << " MB of " 
+		<< (size_t(mSettings.svoMaxNodes) * svoNodeSize) / (1024 * 1024) << " MB, " << timer.GetLastMs() << " ms\n";
+}
+
+void RaytracePass::BuildSummedAreaTable(bool logStats)
+{
+	// prefix sums along x, then y, then z, every workgroup scans one row
+	GpuTimer timer;
+	timer.Begin();
+	mSatScanProgram.Use();
+	mSatScanProgram.BindTexture("bakedVolume", mBakedVolumeTexture.Get());
+	mSatScanProgram.BindImage("sat", mSatVolumeTexture.Get());
+	mSatScanProgram.UpdateUniform("resolution", mBakeSize);
+	for (GLint axis = 0; axis < 3; axis++)
+	{
+		const glm::ivec2 rows = axis == 0 ? glm::ivec2(mBakeSize.y, mBakeSize.z) : (axis == 1 ? glm::ivec2(mBakeSize.x, mBakeSize.z) : glm::ivec2(mBakeSize.x, mBakeSize.y));
+		mSatScanProgram.UpdateUniform("axis", axis);
+		mSatScanProgram.UpdateUniform("fromBake", GLuint(axis == 0));
+		mSatScanProgram.Execute(rows.x, rows.y, 1);
+
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+	}
+	timer.End();
+
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+	if (!logStats)
+	{
+		return;
+	}
+
+	timer.Flush();
+	const size_t bytesPerVoxel = mSettings.summedAreaTable == RaytraceSettings::SummedAreaTable::Split ? 8 : 4;
+	std::cout << "summed-area table: " << (size_t(mBakeSize.x) * mBakeSize.y * mBakeSize.z * bytesPerVoxel) / (1024 * 1024) << " MB, " 
+		<< timer.GetLastMs() << " ms\n";
+}
+
+void RaytracePass::ResetRadianceCache()
+{
+	const float zero[4] = { 0.f, 0.f, 0.f, 0.f };
+	for (const UniqueTexture& texture : mRadianceCacheTextures)
+	{
+		glClearTexImage(texture.Get(), 0, GL_RGBA, GL_FLOAT, zero);
+	}
+	glClearTexImage(mRadianceCacheCountTexture.Get(), 0, GL_RED, GL_FLOAT, zero);
+
+	mRadianceCacheSlice = 0;
+	mRadianceCacheSlabRays = 0;
+}
+
+void RaytracePass::UpdateRadianceCache(GLuint cubemap)
+{
+	const GLint cacheSize = GLint(mSettings.radianceCacheSize);
+	if (mRadianceCacheSlice >= cacheSize)
+	{
+		return;
+	}
+
+	// fill one slab until it converges before moving on, so whole regions of the volume start using the cache early
+	const GLint numSlices = std::min(GLint(std::max(mSettings.radianceCacheSlices, 1u)), cacheSize - mRadianceCacheSlice);
+	mRadianceCacheTimer.Begin();
+	mRadianceCacheProgram.Use();
+	mRadianceCacheProgram.BindTexture("sigmaVolume", mBakedVolumeTexture.Get());
+	mRadianceCacheProgram.BindTexture("cubemap", cubemap);
+	mRadianceCacheProgram.BindImage("cacheR", mRadianceCacheTextures[0].Get());
+	mRadianceCacheProgram.BindImage("cacheG", mRadianceCacheTextures[1].Get());
+	mRadianceCacheProgram.BindImage("cacheB", mRadianceCacheTextures[2].Get());
+	mRadianceCacheProgram.BindImage("cacheCount", mRadianceCacheCountTexture.Get());
+	mRadianceCacheProgram.UpdateUniform("cacheResolution", glm::ivec3(cacheSize));
+	mRadianceCacheProgram.UpdateUniform("firstSlice", mRadianceCacheSlice);
+	mRadianceCacheProgram.UpdateUniform("numSlices", numSlices);
+	mRadianceCacheProgram.UpdateUniform("raysPerProbe", GLuint(mSettings.radianceCacheRays));
+	mRadianceCacheProgram.UpdateUniform("targetSamples", float(mSettings.radianceCacheSamples));
+	mRadianceCacheProgram.UpdateUniform("update", GLuint(mRadianceCacheUpdates++));
+	mRadianceCacheProgram.UpdateUniform("bakeLodBias", std::log2(glm::compMax(mBakeSize) / 128.f));
+	mRadianceCacheProgram.UpdateUniform("envRotation", mEnvRotation);
+	mRadianceCacheProgram.Execute(numGroups(cacheSize, 4), numGroups(cacheSize, 4), numGroups(numSlices, 4));
+	mRadianceCacheTimer.End();
+
+	glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+
+	mRadianceCacheSlabRays += mSettings.radianceCacheRays;
+	if (mRadianceCacheSlabRays >= mSettings.radianceCacheSamples)
+	{
+		mRadianceCacheSlice += numSlices;
+		mRadianceCacheSlabRays = 0;
+	}
+}
+
+void RaytracePass::BuildPrt(GLint firstSlice, GLint numSlices)
+{
+	const glm::ivec3 prtSize = glm::ivec3(mSettings.prtSize);
+
+	GpuTimer timer;
+	timer.Begin();
+	mPrtProgram.Use();
+	mPrtProgram.BindTexture("sigmaVolume", mBakedVolumeTexture.Get());
+	mPrtProgram.BindImage("prtVolume", mPrtVolumeTexture.Get());
+	mPrtProgram.UpdateUniform("prtResolution", prtSize);
+	mPrtProgram.UpdateUniform("firstSlice", firstSlice);
+	mPrtProgram.UpdateUniform("numSlices", numSlices);
+	mPrtProgram.UpdateUniform("numRays", GLuint(mSettings.prtRays));
+	mPrtProgram.UpdateUniform("bakeLodBias", std::log2(glm::compMax(mBakeSize) / 128.f));
+	mPrtProgram.Execute(numGroups(prtSize.x, 4), numGroups(prtSize.y, 4), numGroups(numSlices, 4));
+	timer.End();
+
+	glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+
+	// the slabs of a re-bake aren't worth a line each
+	if (numSlices < prtSize.z)
+	{
+		return;
+	}
+
+	timer.Flush();
+	std::cout << "prt volume: " << (size_t(prtSize.x) * prtSize.y * prtSize.z * 8) / (1024 * 1024) << " MB, " << timer.GetLastMs() << " ms\n";
+}
+
+void RaytracePass::ProjectEnvironment(GLuint cubemap)
+{
+	mEnvShProgram.Use();
+	mEnvShProgram.BindTexture("cubemap", cubemap);
+	mEnvShProgram.BindBuffer("envSh", mEnvShBuffer.Get());
+	mEnvShProgram.UpdateUniform("samplesPerInvocation", GLuint(64));
+	mEnvShProgram.Execute(1, 1, 1);
+
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	mEnvShCubemap = cubemap;
+}
+
+void RaytracePass::SetEnvironmentRotation(const glm::mat3& rotation)
+{
+	if (rotation == mEnvRotation)
+	{
+		return;
+	}
+
+	mEnvRotation = rotation;
+	mItrs = 1;
+	mHistoryValid = false;
+
+	// the cache holds the rotated environment, prt only needs the new rotation
+	if (mSettings.radianceCache)
+	{
+		ResetRadianceCache();
+	}
+}
+
+void RaytracePass::SetQuality(uint32_t activeSamples, float stepScale)
+{
+	activeSamples = glm::clamp(activeSamples, 1u, mNumSamples);
+	if (activeSamples == mActiveSamples && stepScale == mStepScale)
+	{
+		return;
+	}
+
+	mActiveSamples = activeSamples;
+	mStepScale = stepScale;
+	mItrs = 1;
+}
+
+void RaytracePass::SetRenderScale(float scale)
+{
+	const glm::ivec2 renderSize = glm::clamp(glm::ivec2(glm::vec2(mSize) * scale + 0.5f), glm::ivec2(16), mSize);
+	if (renderSize == mRenderSize)
+	{
+		return;
+	}
+
+	mRenderSize = renderSize;
+	mItrs = 1;
+}
+
+void RaytracePass::SetLights(const std::vector<Light>& lights)
+{
+	mNumLights = GLint(std::min(lights.size(), mLightPositions.size()));
+	for (GLint i = 0; i < mNumLights; i++)
+	{
+		const Light& light = lights[i];
+		mLightPositions[i] = glm::vec4(light.type == Light::Type::Directional ? glm::normalize(light.vector) : light.vector, float(light.type));
+		mLightColors[i] = glm::vec4(light.color, 0.f);
+	}
+
+	mLightsDirty = true;
+	mItrs = 1;
+	mHistoryValid = false;
+}
+
+void RaytracePass::BuildLightVolume()
+{
+	const glm::ivec3 lightSize = glm::ivec3(mSettings.lightVolumeSize);
+
+	// march the bake mip whose voxels are about as big as the light volume's
+	const float bakeLevel = std::max(std::log2(float(glm::compMax(mBakeSize)) / float(mSettings.lightVolumeSize)), 0.f);
+
+	GpuTimer timer;
+	timer.Begin();
+	mLightVolumeProgram.Use();
+	mLightVolumeProgram.BindTexture("sigmaVolume", mBakedVolumeTexture.Get());
+	mLightVolumeProgram.BindImage("lightVolume", mLightVolumeTexture.Get());
+	mLightVolumeProgram.UpdateUniform("lightResolution", lightSize);
+	mLightVolumeProgram.UpdateUniform("lightPositions", mLightPositions);
+	mLightVolumeProgram.UpdateUniform("numLights", mNumLights);
+	mLightVolumeProgram.UpdateUniform("bakeLevel", bakeLevel);
+	mLightVolumeProgram.Execute(numGroups(lightSize.x, 4), numGroups(lightSize.y, 4), numGroups(lightSize.z, 4));
+	timer.End();
+
+	glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+
+	mLightsDirty = false;
+	if (mLightVolumeBuilt)
+	{
+		return;
+	}
+	mLightVolumeBuilt = true;
+
+	timer.Flush();
+	std::cout << "light volume: " << mNumLights << " lights, " << timer.GetLastMs() << " ms\n";
+}
+
+void RaytracePass::BuildMultipleScatteringLUT()
+{
+	// (albedo, optical radius) table, it only depends on the phase function and surface model so it's never rebuilt
+	const glm::ivec2 lutSize = glm::ivec2(32);
+
+	glBindTexture(GL_TEXTURE_2D, mMultipleScatteringTexture.Get());
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_RG16F, lutSize.x, lutSize.y);
+
+	GpuTimer timer;
+	timer.Begin();
+	mMultipleScatteringProgram.Use();
+	mMultipleScatteringProgram.BindImage("msLUT", mMultipleScatteringTexture.Get());
+	mMultipleScatteringProgram.UpdateUniform("lutResolution", lutSize);
+	mMultipleScatteringProgram.UpdateUniform("numWalks", GLuint(4096));
+	mMultipleScatteringProgram.Execute(numGroups(lutSize.x, 8), numGroups(lutSize.y, 8), 1);
+	timer.End();
+
+	glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+
+	timer.Flush();
+	std::cout << "multiple scattering lut: " << lutSize.x << "x" << lutSize.y << ", " << timer.GetLastMs() << " ms\n";
+}
+
+void RaytracePass::ClearQueue(const UniqueBuffer& queue)
+{
+	// the args are filled in once it's been appended to
+	const GLuint zero = 0;
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, queue.Get());
+	glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, 0, 4 * sizeof(GLuint), GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+}
+
+void RaytracePass::PrepareQueue(const UniqueBuffer& queue, GLuint itemsPerGroup, GLuint groupsPerItem)
+{
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	mQueueArgsProgram.Use();
+	mQueueArgsProgram.BindBuffer("queue", queue.Get());
+	mQueueArgsProgram.UpdateUniform("itemsPerGroup", itemsPerGroup);
+	mQueueArgsProgram.UpdateUniform("groupsPerItem", groupsPerItem);
+	mQueueArgsProgram.Execute(1, 1, 1);
+
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void RaytracePass::FindUnconvergedTiles()
+{
+	const glm::ivec2 numTiles = (mRenderSize + 15) / 16;
+
+	mTileTimer.Begin();
+	ClearQueue(mTileQueueBuffer);
+	mTileErrorProgram.Use();
+	mTileErrorProgram.BindImage("imgOutput", mColorTexture.Get());
+	mTileErrorProgram.BindBuffer("tileQueue", mTileQueueBuffer.Get());
+	mTileErrorProgram.UpdateUniform("numSamples", GLuint(mNumSamples));
+	mTileErrorProgram.UpdateUniform("activeSamples", GLuint(mActiveSamples));
+	mTileErrorProgram.UpdateUniform("renderSize", mRenderSize);
+	mTileErrorProgram.UpdateUniform("itrs", mItrs);
+	mTileErrorProgram.UpdateUniform("minItrs", GLint(mSettings.adaptiveMinItrs));
+	mTileErrorProgram.UpdateUniform("threshold", mSettings.adaptiveThreshold);
+	mTileErrorProgram.Execute(numTiles.x, numTiles.y, 1);
+	PrepareQueue(mTileQueueBuffer, 1, mNumSamples);
+	mTileTimer.End();
+
+	// reading the count back stalls, so convergence is only checked every few iterations
+	if (mConvergedItrs == 0 && mItrs > GLint(mSettings.adaptiveMinItrs) && mItrs % 8 == 0)
+	{
+		glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+		GLuint activeTiles = 0;
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, mTileQueueBuffer.Get());
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 3 * sizeof(GLuint), sizeof(GLuint), &activeTiles);
+		if (activeTiles == 0)
+		{
+			mConvergedItrs = mItrs;
+			std::cout << "every tile under the noise threshold after " << mConvergedItrs << " itrs\n";
+		}
+	}
+}
+
+void RaytracePass::UpdateScreenRect()
+{
+	mScreenRectMin = glm::ivec2(0);
+	mScreenRectMax = mRenderSize;
+	if (!mSettings.screenRect)
+	{
+		return;
+	}
+
+	// same camera as gen_rays.glsl, a screen pixel p takes the rays through [p, p + 1)
+	const glm::mat4 worldToCamera = glm::inverse(mView);
+	const glm::vec2 halfRes = glm::vec2(mRenderSize) * 0.5f;
+	const float focalLength = 1.f / std::tan(glm::radians(45.f) * 0.5f);
+
+	// with every corner in front of the camera the box projects inside the bounds of its projected corners
+	glm::vec2 lo(std::numeric_limits<float>::max()), hi(std::numeric_limits<float>::lowest());
+	for (int corner = 0; corner < 8; corner++)
+	{
+		const glm::vec3 p = glm::mix(mLowerBound, -mLowerBound, glm::vec3(corner & 1, (corner >> 1) & 1, (corner >> 2) & 1));
+		const glm::vec3 cam = glm::vec3(worldToCamera * glm::vec4(p, 1.f));
+		if (cam.z <= 1e-4f)
+		{
+			return;
+		}
+
+		const glm::vec2 screen = glm::vec2(cam) / cam.z * focalLength * halfRes.y + halfRes;
+		lo = glm::min(lo, screen);
+		hi = glm::max(hi, screen);
+	}
+
+	mScreenRectMin = glm::clamp(glm::ivec2(glm::floor(lo)), glm::ivec2(0), mRenderSize);
+	mScreenRectMax = glm::clamp(glm::ivec2(glm::floor(hi)) + 1, mScreenRectMin, mRenderSize);
+}
+
+void RaytracePass::BuildEntryCache()
+{
+	const GLint level = std::min(GLint(mSettings.entryCacheLevel), mBakeLevels - 1);
+	const glm::vec3 cellSize = glm::vec3(float(1 << level)) / glm::vec3(mBakeSize);
+
+	mEntryCacheTimer.Begin();
+	mEntryCacheProgram.Use();
+	mEntryCacheProgram.BindTexture("bakedVolume", mBakedVolumeTexture.Get());
+	mEntryCacheProgram.BindImage("entryTex", mEntryTexture.Get());
+	mEntryCacheProgram.UpdateUniform("view", mView);
+	mEntryCacheProgram.UpdateUniform("renderSize", mRenderSize);
+	mEntryCacheProgram.UpdateUniform("lowerBound", mLowerBound);
+	mEntryCacheProgram.UpdateUniform("scaleFactor", mScaleFactor);
+	mEntryCacheProgram.UpdateUniform("level", float(level));
+	mEntryCacheProgram.UpdateUniform("cellSize", cellSize);
+	mEntryCacheProgram.Execute(numGroups(mRenderSize.x, 16), numGroups(mRenderSize.y, 16), 1);
+	mEntryCacheTimer.End();
+
+	glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+}
+
+void RaytracePass::FindFirstHits(bool reproject)
+{
+	mFirstHitProgram.Use();
+	mFirstHitProgram.BindTexture("bakedVolume", mBakedVolumeTexture.Get());
+	mFirstHitProgram.BindTexture("historyGBuffer", mHistoryGBufferTexture.Get());
+	mFirstHitProgram.BindImage("gbufferTex", mGBufferTexture.Get());
+	mFirstHitProgram.BindImage("reprojectTex", mReprojectTexture.Get());
+	mFirstHitProgram.UpdateUniform("view", mView);
+	mFirstHitProgram.UpdateUniform("renderSize", mRenderSize);
+	mFirstHitProgram.UpdateUniform("lowerBound", mLowerBound);
+	mFirstHitProgram.UpdateUniform("scaleFactor", mScaleFactor);
+	mFirstHitProgram.UpdateUniform("bakeResolution", glm::vec3(mBakeSize));
+	mFirstHitProgram.UpdateUniform("reproject", GLuint(reproject));
+	mFirstHitProgram.UpdateUniform("prevInvView", glm::inverse(mLastView));
+	mFirstHitProgram.UpdateUniform("prevRenderSize", mLastRenderSize);
+	mFirstHitProgram.Execute(numGroups(mRenderSize.x, 16), numGroups(mRenderSize.y, 16), 1);
+
+	glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+}
+
+void RaytracePass::Preclassify(GLuint transferLUT, GLuint opacityLUT)
+{
+	const glm::ivec3 scanSize = mDicom.lock()->GetScanSize();
+
+	mClassifyProgram.Use();
+	mClassifyProgram.BindTexture("rawVolume", mDicom.lock()->GetTexture().Get());
+	mClassifyProgram.BindTexture("transferLUT", transferLUT);
+	mClassifyProgram.BindTexture("opacityLUT", opacityLUT);
+	mClassifyProgram.BindImage("classifiedVolume", mClassifiedVolumeTexture.Get());
+	mClassifyProgram.UpdateUniform("scanResolution", scanSize);
+	mClassifyProgram.Execute(numGroups(scanSize.x, 8), numGroups(scanSize.y, 8), numGroups(scanSize.z, 8));
+
+	glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+}
+
+void RaytracePass::PrecomputeGradient()
+{
+	const glm::ivec3 scanSize = mDicom.lock()->GetScanSize();
+
+	GpuTimer timer;
+	timer.Begin();
+	mGradientProgram.Use();
+	mGradientProgram.BindTexture("rawVolume", mDicom.lock()->GetTexture().Get());
+	mGradientProgram.BindImage("gradientVolume", mGradientVolumeTexture.Get());
+	mGradientProgram.UpdateUniform("scanResolution", scanSize);
+	mGradientProgram.UpdateUniform("kernel", GLuint(mSettings.gradient));
+	mGradientProgram.Execute(numGroups(scanSize.x, 8), numGroups(scanSize.y, 8), numGroups(scanSize.z, 8));
+	timer.End();
 
 	glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
 
-	// generate mipmap for the volume texture generated in the previous compute shader
-	glGenerateTextureMipmap(mBakedVolumeTexture.Get());
+	// memory/time tradeoff against the 6 taps per shading point it saves (compare the trace times in LogTimings)
+	timer.Flush();
+	const size_t bytesPerVoxel = mSettings.gradientFormat == GL_RGBA16 ? 8 : 4;
+	std::cout << (mSettings.gradient == RaytraceSettings::Gradient::Sobel ? "sobel" : "central difference") << " gradient volume: " 
+		<< (size_t(scanSize.x) * scanSize.y * scanSize.z * bytesPerVoxel) / (1024 * 1024) << " MB, " << timer.GetLastMs() << " ms\n";
 }
 
 void RaytracePass::Execute(GLuint transferLUT, GLuint opacityLUT, GLuint clearcoatLUT, GLuint cubemap, GLuint volume)
@@ -93,51 +1025,379 @@ void RaytracePass::Execute(GLuint transferLUT, GLuint opacityLUT, GLuint clearco
 	const glm::vec3 boundDim = (upperBound - mLowerBound);
 	mScaleFactor = 1.f / boundDim;
 
+	mIterationTimer.Begin();
+
+	UpdateBake(transferLUT, opacityLUT);
+
+	if (mLightsDirty && mNumLights > 0)
+	{
+		BuildLightVolume();
+	}
+
+	if (mSettings.wavefront)
+	{
+		ClearQueue(mTraceQueueBuffer);
+		ClearQueue(mDirectQueueBuffer);
+	}
+
+	if (mItrs == 1)
+	{
+		mConvergedItrs = 0;
+	}
+
+	// a restart that only moved the camera or lowered quality starts from the last iteration's accumulation, 
+	// reprojected to the new view by the trace pass
+	const bool reproject = mSettings.temporalReuse && mItrs == 1 && mHistoryValid;
+	if (reproject)
+	{
+		glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+		glCopyImageSubData(mColorTexture.Get(), GL_TEXTURE_2D, 0, 0, 0, 0, mHistoryTexture.Get(), GL_TEXTURE_2D, 0, 0, 0, 0,
+			mLastRenderSize.x * mNumSamples, mLastRenderSize.y, 1);
+		mGBufferTexture.Swap(mHistoryGBufferTexture);
+	}
+
+	if (mSettings.temporalReuse && mItrs == 1)
+	{
+		FindFirstHits(reproject);
+	}
+
+	if (mSettings.adaptiveSampling)
+	{
+		FindUnconvergedTiles();
+	}
+
+	// the cache is built from the bake, so it can only be trusted once a re-bake is done, which restarts accumulation
+	const bool entryCache = mSettings.entryCache && mRebakeSlice >= mBakeSize.z;
+	if (entryCache && mItrs == 1)
+	{
+		BuildEntryCache();
+	}
+
+	UpdateScreenRect();
+	const glm::ivec2 rectSize = mScreenRectMax - mScreenRectMin;
+	if (mSettings.screenRect && mItrs == 1)
+	{
+		mEnvFillProgram.Use();
+		mEnvFillProgram.BindTexture("cubemap", cubemap);
+		mEnvFillProgram.BindImage("imgOutput", mColorTexture.Get());
+		mEnvFillProgram.BindImage("accumTex", mAccumTexture.Get());
+		mEnvFillProgram.UpdateUniform("numSamples", GLuint(mNumSamples));
+		mEnvFillProgram.UpdateUniform("view", mView);
+		mEnvFillProgram.UpdateUniform("envRotation", mEnvRotation);
+		mEnvFillProgram.UpdateUniform("renderSize", mRenderSize);
+		mEnvFillProgram.UpdateUniform("screenRectMin", mScreenRectMin);
+		mEnvFillProgram.UpdateUniform("screenRectMax", mScreenRectMax);
+		mEnvFillProgram.Execute(numGroups(mRenderSize.x, 16), numGroups(mRenderSize.y, 16), 1);
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+	}
+
 	// generate the camera rays
+	mGenRaysTimer.Begin();
 	mGenRaysProgram.Use();
+	mGenRaysProgram.BindTexture("cubemap", cubemap);
 	mGenRaysProgram.BindImage("imgOutput", mColorTexture.Get());
 	mGenRaysProgram.BindImage("rayPosTex", mPosTexture.Get());
 	mGenRaysProgram.BindImage("accumTex", mAccumTexture.Get());
+	mGenRaysProgram.BindBuffer("traceQueue", mTraceQueueBuffer.Get());
+	mGenRaysProgram.BindBuffer("tileQueue", mTileQueueBuffer.Get());
 	mGenRaysProgram.UpdateUniform("numSamples", GLuint(mNumSamples));
 	mGenRaysProgram.UpdateUniform("view", mView);
 	mGenRaysProgram.UpdateUniform("itrs", mItrs);
-	mGenRaysProgram.Execute((mSize.x * mNumSamples) / 16, mSize.y / 16, 1);
-
-	// trace the camera rays
-	mRaytraceProgram.Use();
-	mRaytraceProgram.BindTexture("rawVolume", volume);
-	mRaytraceProgram.BindTexture("transferLUT", transferLUT);
-	mRaytraceProgram.BindTexture("opacityLUT", opacityLUT);
-	mRaytraceProgram.BindTexture("cubemap", cubemap);
-	mRaytraceProgram.BindTexture("clearcoatLUT", clearcoatLUT);
-	mRaytraceProgram.BindImage("imgOutput", mColorTexture.Get());
-	mRaytraceProgram.BindImage("rayPosTex", mPosTexture.Get());
-	mRaytraceProgram.BindImage("accumTex", mAccumTexture.Get());
-	mRaytraceProgram.UpdateUniform("numSamples", GLuint(mNumSamples));
-	mRaytraceProgram.UpdateUniform("scaleFactor", mScaleFactor);
-	mRaytraceProgram.UpdateUniform("scanSize", scanSize);
-	mRaytraceProgram.UpdateUniform("scanResolution", glm::vec3(mDicom.lock()->GetScanSize()));
-	mRaytraceProgram.UpdateUniform("lowerBound", mLowerBound);
-	mRaytraceProgram.UpdateUniform("view", mView);
-	mRaytraceProgram.UpdateUniform("itrs", mItrs);
-	mRaytraceProgram.UpdateUniform("depth", GLuint(1));
-	mRaytraceProgram.Execute((mSize.x * mNumSamples) / 16, mSize.y / 16, 1);
-	
-	// trace the direct lighting rays
-	mConeTraceProgram.Use();
-	mConeTraceProgram.BindTexture("sigmaVolume", mBakedVolumeTexture.Get());
-	mConeTraceProgram.BindTexture("cubemap", cubemap);
-	mConeTraceProgram.BindTexture("clearcoatLUT", clearcoatLUT);
-	mConeTraceProgram.BindImage("imgOutput", mColorTexture.Get());
-	mConeTraceProgram.BindImage("rayPosTex", mPosTexture.Get());
-	mConeTraceProgram.BindImage("accumTex", mAccumTexture.Get());
-	mConeTraceProgram.UpdateUniform("numSamples", GLuint(mNumSamples));
-	mConeTraceProgram.UpdateUniform("scaleFactor", mScaleFactor);
-	mConeTraceProgram.UpdateUniform("lowerBound", mLowerBound);
-	mConeTraceProgram.UpdateUniform("itrs", mItrs);
-	mConeTraceProgram.Execute((mSize.x * mNumSamples) / 16, mSize.y / 16, 1);
+	mGenRaysProgram.UpdateUniform("wavefront", GLuint(mSettings.wavefront));
+	mGenRaysProgram.UpdateUniform("lowerBound", mLowerBound);
+	mGenRaysProgram.UpdateUniform("envRotation", mEnvRotation);
+	mGenRaysProgram.UpdateUniform("adaptive", GLuint(mSettings.adaptiveSampling));
+	mGenRaysProgram.UpdateUniform("activeSamples", GLuint(mActiveSamples));
+	mGenRaysProgram.UpdateUniform("renderSize", mRenderSize);
+	mGenRaysProgram.UpdateUniform("screenRectMin", mScreenRectMin);
+	mGenRaysProgram.UpdateUniform("screenRectMax", mScreenRectMax);
+	mGenRaysProgram.UpdateUniform("entryCache", GLuint(entryCache));
+	if (entryCache)
+	{
+		mGenRaysProgram.BindImage("entryTex", mEntryTexture.Get());
+	}
+	if (mSettings.adaptiveSampling)
+	{
+		mGenRaysProgram.ExecuteIndirect(mTileQueueBuffer.Get());
+	}
+	else
+	{
+		mGenRaysProgram.Execute(numGroups(rectSize.x * mActiveSamples, 16), numGroups(rectSize.y, 16), 1);
+	}
+	if (mSettings.wavefront)
+	{
+		PrepareQueue(mTraceQueueBuffer);
+	}
+	mGenRaysTimer.End();
+
+	if (mSettings.radianceCache)
+	{
+		UpdateRadianceCache(cubemap);
+	}
+
+	if (mSettings.prt && cubemap != mEnvShCubemap)
+	{
+		ProjectEnvironment(cubemap);
+	}
+
+	// every bounce traces the live paths on to their next vertex and adds the direct lighting there, the first 
+	// bounce's two passes are timed separately and later bounces as a whole
+	const GLuint numBounces = std::clamp(mSettings.maxBounces, 1u, GLuint(mBounceTimers.size()));
+	for (GLuint bounce = 0; bounce < numBounces; bounce++)
+	{
+		if (bounce == 0)
+		{
+			mTraceTimer.Begin();
+		}
+		else
+		{
+			mBounceTimers[bounce].Begin();
+
+			// the paths the last direct pass lit are the ones left to trace, terminated ones were never queued
+			if (mSettings.wavefront)
+			{
+				mTraceQueueBuffer.Swap(mDirectQueueBuffer);
+				ClearQueue(mDirectQueueBuffer);
+			}
+		}
+
+		// trace the rays to their next vertex
+		mRaytraceProgram.Use();
+		mRaytraceProgram.BindTexture("rawVolume", volume);
+		mRaytraceProgram.BindTexture("transferLUT", transferLUT);
+		mRaytraceProgram.BindTexture("opacityLUT", opacityLUT);
+		mRaytraceProgram.BindTexture("cubemap", cubemap);
+		mRaytraceProgram.BindTexture("clearcoatLUT", clearcoatLUT);
+		mRaytraceProgram.BindTexture("classifiedVolume", mClassifiedVolumeTexture.Get());
+		mRaytraceProgram.BindTexture("preintegratedTable", mPreintegratedTable.Unique().Get());
+		mRaytraceProgram.BindTexture("gradientVolume", mGradientVolumeTexture.Get());
+		mRaytraceProgram.BindTexture("lightVolume", mLightVolumeTexture.Get());
+		mRaytraceProgram.BindTexture("msLUT", mMultipleScatteringTexture.Get());
+		mRaytraceProgram.BindTexture("bakedVolume", mBakedVolumeTexture.Get());
+		mRaytraceProgram.BindImage("imgOutput", mColorTexture.Get());
+		mRaytraceProgram.BindImage("rayPosTex", mPosTexture.Get());
+		mRaytraceProgram.BindImage("accumTex", mAccumTexture.Get());
+		mRaytraceProgram.BindImage("lightTex", mLightTexture.Get());
+		mRaytraceProgram.BindImage("weightTex", mWeightTexture.Get());
+		mRaytraceProgram.BindBuffer("traceQueue", mTraceQueueBuffer.Get());
+		mRaytraceProgram.BindBuffer("directQueue", mDirectQueueBuffer.Get());
+		mRaytraceProgram.BindBuffer("tileQueue", mTileQueueBuffer.Get());
+		mRaytraceProgram.UpdateUniform("numSamples", GLuint(mNumSamples));
+		mRaytraceProgram.UpdateUniform("scaleFactor", mScaleFactor);
+		mRaytraceProgram.UpdateUniform("scanSize", scanSize);
+		mRaytraceProgram.UpdateUniform("scanResolution", glm::vec3(mDicom.lock()->GetScanSize()));
+		mRaytraceProgram.UpdateUniform("lowerBound", mLowerBound);
+		mRaytraceProgram.UpdateUniform("view", mView);
+		mRaytraceProgram.UpdateUniform("itrs", mItrs);
+		mRaytraceProgram.UpdateUniform("depth", bounce + 1);
+		mRaytraceProgram.UpdateUniform("coarseStepScale", mSettings.coarseStepScale * mStepScale);
+		mRaytraceProgram.UpdateUniform("refineSteps", GLuint(mSettings.refineSteps));
+		mRaytraceProgram.UpdateUniform("classification", GLuint(mSettings.classification));
+		mRaytraceProgram.UpdateUniform("precomputedGradient", GLuint(mSettings.gradient != RaytraceSettings::Gradient::Runtime));
+		mRaytraceProgram.UpdateUniform("envRotation", mEnvRotation);
+		mRaytraceProgram.UpdateUniform("lightPositions", mLightPositions);
+		mRaytraceProgram.UpdateUniform("lightColors", mLightColors);
+		mRaytraceProgram.UpdateUniform("numLights", mNumLights);
+		mRaytraceProgram.UpdateUniform("multipleScattering", GLuint(mSettings.multipleScattering));
+		mRaytraceProgram.UpdateUniform("msRadius", mSettings.multipleScatteringRadius);
+		mRaytraceProgram.UpdateUniform("msBakeLevel", std::max(std::log2(2.f * mSettings.multipleScatteringRadius * glm::compMax(mBakeSize)), 0.f));
+		mRaytraceProgram.UpdateUniform("wavefront", GLuint(mSettings.wavefront));
+		mRaytraceProgram.UpdateUniform("adaptive", GLuint(mSettings.adaptiveSampling));
+		mRaytraceProgram.UpdateUniform("activeSamples", GLuint(mActiveSamples));
+		mRaytraceProgram.UpdateUniform("renderSize", mRenderSize);
+		mRaytraceProgram.UpdateUniform("screenRectMin", mScreenRectMin);
+		mRaytraceProgram.UpdateUniform("screenRectMax", mScreenRectMax);
+		mRaytraceProgram.UpdateUniform("reproject", GLuint(reproject && bounce == 0));
+		mRaytraceProgram.UpdateUniform("entryCache", GLuint(entryCache));
+		if (entryCache)
+		{
+			mRaytraceProgram.BindImage("entryTex", mEntryTexture.Get());
+		}
+		if (mSettings.temporalReuse)
+		{
+			mRaytraceProgram.BindImage("reprojectTex", mReprojectTexture.Get());
+			mRaytraceProgram.BindTexture("historyTex", mHistoryTexture.Get());
+			mRaytraceProgram.UpdateUniform("prevActiveSamples", GLuint(mLastActiveSamples));
+			mRaytraceProgram.UpdateUniform("maxHistory", float(mSettings.temporalMaxHistory));
+		}
+		const glm::ivec2 gridGroups(numGroups(rectSize.x * mActiveSamples, 16), numGroups(rectSize.y, 16));
+		mRaytraceProgram.UpdateUniform("persistent", GLuint(mSettings.persistentThreads));
+		mRaytraceProgram.UpdateUniform("gridGroups", gridGroups);
+		mRaytraceProgram.UpdateUniform("schedulerStats", GLuint(mSettings.schedulerStats));
+		if (mSettings.persistentThreads || mSettings.schedulerStats)
+		{
+			// every pass starts at the first ray, the step counts add up over the iteration
+			const GLuint zero = 0;
+			glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, mRaySchedulerBuffer.Get());
+			glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, 0, (bounce == 0 ? 5 : 1) * sizeof(GLuint), GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+			mRaytraceProgram.BindBuffer("rayScheduler", mRaySchedulerBuffer.Get());
+		}
+		if (mSettings.persistentThreads)
+		{
+			// the same rays as the dispatches below, pulled by workgroups that stay resident until they run out
+			mRaytraceProgram.Execute(GLuint(std::max(mSettings.persistentGroups, 1u)), 1, 1);
+		}
+		else if (mSettings.wavefront)
+		{
+			mRaytraceProgram.ExecuteIndirect(mTraceQueueBuffer.Get());
+		}
+		else if (mSettings.adaptiveSampling)
+		{
+			mRaytraceProgram.ExecuteIndirect(mTileQueueBuffer.Get());
+		}
+		else
+		{
+			mRaytraceProgram.Execute(gridGroups.x, gridGroups.y, 1);
+		}
+		if (mSettings.wavefront)
+		{
+			PrepareQueue(mDirectQueueBuffer);
+		}
+
+		if (bounce == 0)
+		{
+			mTraceTimer.End();
+			mConeTraceTimer.Begin();
+		}
+
+		// trace the direct lighting rays
+		mConeTraceProgram.Use();
+		mConeTraceProgram.BindTexture("sigmaVolume", mBakedVolumeTexture.Get());
+		mConeTraceProgram.BindTexture("cubemap", cubemap);
+		mConeTraceProgram.BindTexture("clearcoatLUT", clearcoatLUT);
+		mConeTraceProgram.BindTexture("anisoVolume", mAnisoVolumeTexture.Get());
+		mConeTraceProgram.BindTexture("satVolume", mSatVolumeTexture.Get());
+		mConeTraceProgram.BindBuffer("svoNodes", mSvoNodeBuffer.Get());
+		mConeTraceProgram.BindTexture("radianceCacheR", mRadianceCacheTextures[0].Get());
+		mConeTraceProgram.BindTexture("radianceCacheG", mRadianceCacheTextures[1].Get());
+		mConeTraceProgram.BindTexture("radianceCacheB", mRadianceCacheTextures[2].Get());
+		mConeTraceProgram.BindTexture("radianceCacheCount", mRadianceCacheCountTexture.Get());
+		mConeTraceProgram.BindTexture("prtVolume", mPrtVolumeTexture.Get());
+		mConeTraceProgram.BindBuffer("envSh", mEnvShBuffer.Get());
+		mConeTraceProgram.BindImage("imgOutput", mColorTexture.Get());
+		mConeTraceProgram.BindImage("rayPosTex", mPosTexture.Get());
+		mConeTraceProgram.BindImage("accumTex", mAccumTexture.Get());
+		mConeTraceProgram.BindImage("lightTex", mLightTexture.Get());
+		mConeTraceProgram.BindImage("weightTex", mWeightTexture.Get());
+		mConeTraceProgram.BindBuffer("directQueue", mDirectQueueBuffer.Get());
+		mConeTraceProgram.BindBuffer("tileQueue", mTileQueueBuffer.Get());
+		mConeTraceProgram.UpdateUniform("numSamples", GLuint(mNumSamples));
+		mConeTraceProgram.UpdateUniform("scaleFactor", mScaleFactor);
+		mConeTraceProgram.UpdateUniform("lowerBound", mLowerBound);
+		mConeTraceProgram.UpdateUniform("itrs", mItrs);
+		mConeTraceProgram.UpdateUniform("bakeLodBias", std::log2(glm::compMax(mBakeSize) / 128.f));
+		mConeTraceProgram.UpdateUniform("anisotropic", GLuint(mSettings.anisotropic));
+		mConeTraceProgram.UpdateUniform("coneStepScale", mSettings.coneStepScale * mStepScale);
+		mConeTraceProgram.UpdateUniform("svoDepth", mSvoDepth);
+		mConeTraceProgram.UpdateUniform("svoScale", scanSize / float(1 << mSvoDepth));
+		mConeTraceProgram.UpdateUniform("svoLevelBias", std::log2(glm::compMax(scanSize) / glm::compMax(mBakeSize)));
+		mConeTraceProgram.UpdateUniform("summedAreaTable", GLuint(mSettings.summedAreaTable != RaytraceSettings::SummedAreaTable::Off));
+		mConeTraceProgram.UpdateUniform("bakeResolution", glm::vec3(mBakeSize));
+		mConeTraceProgram.UpdateUniform("radianceCache", GLuint(mSettings.radianceCache));
+		mConeTraceProgram.UpdateUniform("radianceCacheSamples", float(mSettings.radianceCacheSamples));
+		mConeTraceProgram.UpdateUniform("prt", GLuint(mSettings.prt));
+		mConeTraceProgram.UpdateUniform("envRotation", mEnvRotation);
+		mConeTraceProgram.UpdateUniform("numLights", mNumLights);
+		mConeTraceProgram.UpdateUniform("wavefront", GLuint(mSettings.wavefront));
+		mConeTraceProgram.UpdateUniform("depth", bounce + 1);
+		mConeTraceProgram.UpdateUniform("adaptive", GLuint(mSettings.adaptiveSampling));
+		mConeTraceProgram.UpdateUniform("activeSamples", GLuint(mActiveSamples));
+		mConeTraceProgram.UpdateUniform("renderSize", mRenderSize);
+		mConeTraceProgram.UpdateUniform("screenRectMin", mScreenRectMin);
+		mConeTraceProgram.UpdateUniform("screenRectMax", mScreenRectMax);
+		if (mSettings.wavefront)
+		{
+			mConeTraceProgram.ExecuteIndirect(mDirectQueueBuffer.Get());
+		}
+		else if (mSettings.adaptiveSampling)
+		{
+			mConeTraceProgram.ExecuteIndirect(mTileQueueBuffer.Get());
+		}
+		else
+		{
+			mConeTraceProgram.Execute(numGroups(rectSize.x * mActiveSamples, 16), numGroups(rectSize.y, 16), 1);
+		}
+
+		if (bounce == 0)
+		{
+			mConeTraceTimer.End();
+		}
+		else
+		{
+			mBounceTimers[bounce].End();
+		}
+
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+	}
 
 	glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+
+	mIterationTimer.End();
+
+	// what the next view change reprojects from
+	mLastView = mView;
+	mLastRenderSize = mRenderSize;
+	mLastActiveSamples = mActiveSamples;
+	mHistoryValid = true;
 	
 	mItrs++;
+}
+
+void RaytracePass::LogTimings(std::ostream& out) const
+{
+	static const char* classificationNames[] = { "post-classified", "pre-classified", "pre-integrated" };
+	out << classificationNames[GLuint(mSettings.classification)] << " gpu times [ms]:"
+		<< " gen rays " << mGenRaysTimer.GetAverageMs()
+		<< ", trace " << mTraceTimer.GetAverageMs()
+		<< ", cone trace " << mConeTraceTimer.GetAverageMs();
+	if (mSettings.radianceCache)
+	{
+		out << ", radiance cache " << mRadianceCacheTimer.GetAverageMs();
+	}
+	if (mSettings.adaptiveSampling)
+	{
+		out << ", tile error " << mTileTimer.GetAverageMs();
+	}
+	if (mSettings.screenRect)
+	{
+		const glm::ivec2 rectSize = mScreenRectMax - mScreenRectMin;
+		out << ", screen rect " << 100.0 * rectSize.x * rectSize.y / (double(mRenderSize.x) * mRenderSize.y) << "% of the render";
+	}
+	if (mSettings.entryCache)
+	{
+		out << ", entry cache " << mEntryCacheTimer.GetAverageMs() << " (" << mEntryCacheTimer.GetCount() << " builds)";
+	}
+	for (size_t bounce = 1; bounce < std::min(size_t(mSettings.maxBounces), mBounceTimers.size()); bounce++)
+	{
+		out << ", bounce " << bounce + 1 << " " << mBounceTimers[bounce].GetAverageMs();
+	}
+	if (mSettings.wavefront)
+	{
+		// counts of the last iteration, the queues are only cleared at the start of the next one
+		GLuint traceCount = 0, directCount = 0;
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, mTraceQueueBuffer.Get());
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 3 * sizeof(GLuint), sizeof(GLuint), &traceCount);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, mDirectQueueBuffer.Get());
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 3 * sizeof(GLuint), sizeof(GLuint), &directCount);
+		out << ", " << traceCount << " traced and " << directCount << " direct of " << size_t(mRenderSize.x) * mActiveSamples * mRenderSize.y << " rays";
+	}
+	if (mSettings.schedulerStats)
+	{
+		// of the last iteration, the share of the march steps the trace pass's workgroups were resident for that lanes 
+		// spent marching. Shading and taking rays aren't steps, so the pass's time is what to compare the two modes by
+		GLuint laneSteps[4] = {};
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, mRaySchedulerBuffer.Get());
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint), sizeof(laneSteps), laneSteps);
+		const double marched = laneSteps[0] + 4294967296.0 * laneSteps[1];
+		const double resident = laneSteps[2] + 4294967296.0 * laneSteps[3];
+		out << ", trace lane utilization " << (resident > 0.0 ? 100.0 * marched / resident : 100.0) << "% in "
+			<< mTraceTimer.GetAverageMs() << (mSettings.persistentThreads ? " (persistent threads)" : " (a lane per ray)");
+	}
+	out << ", whole iteration " << mIterationTimer.GetAverageMs() << " (" << mTraceTimer.GetCount() << " itrs)\n";
+	if (mSettings.adaptiveSampling && mConvergedItrs != 0)
+	{
+		const double itrMs = mGenRaysTimer.GetAverageMs() + mTraceTimer.GetAverageMs() + mConeTraceTimer.GetAverageMs() + mTileTimer.GetAverageMs();
+		out << "noise threshold reached after " << mConvergedItrs << " itrs, about " << itrMs * mConvergedItrs << " ms of gpu time\n";
+	}
 }
\ No newline at end of file
@@ -1,6 +1,9 @@
 #pragma once
 
+#include <array>
 #include <memory>
+#include <ostream>
+#include <vector>
 
 #include <gl/glew.h>
 #include <glm/glm.hpp>
@@ -9,10 +12,142 @@
 #include "Dicom.h"
 #include "PiecewiseFunction.h"
 
+// explicit light on top of the environment, positions and directions are in the volume's [0, 1] texture space
+struct Light
+{
+	enum class Type : GLuint { Directional = 0, Point = 1 };
+	Type type = Type::Directional;
+	glm::vec3 vector = glm::vec3(0.f, 1.f, 0.f); // direction towards a directional light, position of a point light
+	glm::vec3 color = glm::vec3(1.f); // radiance of a directional light, intensity of a point light
+};
+
+struct RaytraceSettings
+{
+	// primary ray marching
+	// the march steps this many fine steps at a time until a surface is crossed. Free flight integrates at the same 
+	// step, so anything above 1 trades volumetric accuracy and surfaces thinner than a step for speed
+	float coarseStepScale = 1.f;
+	uint32_t refineSteps = 6; // bisection iterations used to find the surface inside the crossed coarse step
+
+	// Post looks the transfer luts up after every volume fetch, Pre bakes them into a scan resolution rgba volume 
+	// up front so each march step is a single fetch, PreIntegrated looks up slab integrals between the densities 
+	// at either end of each step which allows a much larger coarse step scale
+	enum class Classification : GLuint { Post = 0, Pre = 1, PreIntegrated = 2 };
+	Classification classification = Classification::Post;
+	GLenum preclassifiedFormat = GL_RGBA8; // GL_RGBA8 (4 bytes per voxel) or GL_RGBA16 (8 bytes per voxel)
+	uint32_t preintegratedSize = 256; // width and height of the (front, back) density table
+
+	// Runtime takes 6 central difference taps at every shading point, Central and Sobel run that kernel (or a 
+	// smoother 27 tap sobel) over the whole scan up front so shading reads a single texel of a gradient volume
+	enum class Gradient : GLuint { Runtime = 0, Central = 1, Sobel = 2 };
+	Gradient gradient = Gradient::Runtime;
+	GLenum gradientFormat = GL_RGB10_A2; // GL_RGB10_A2 (4 bytes per voxel) or GL_RGBA16 (8 bytes per voxel)
+
+	// memory the baked color/opacity volume used for cone tracing can take up, including its mips. The bake 
+	// follows the scan's physical aspect ratio and never goes past the scan's own resolution
+	float bakeBudgetMB = 20.f;
+
+	// how the baked volume's mips used by cone tracing are reduced. ExtinctionAverage averages the per channel 
+	// extinction opacity^1.5 * (1 - rgb) the cone tracer derives from a texel instead of the texel itself, Max keeps 
+	// the densest child so thin occluders survive at coarse levels, OpacityWeighted averages extinction like the first 
+	// with color weighted by opacity
+	enum class MipReduction : GLuint { ExtinctionAverage = 0, Max = 1, OpacityWeighted = 2 };
+	MipReduction mipReduction = MipReduction::ExtinctionAverage;
+
+	// cone tracing: anisotropic adds a volume of per axis opacity alongside the bake's mips (another 8 bytes per 
+	// baked voxel out of the budget) so thin oriented structures don't leak or smear at coarse levels, which lets 
+	// the cones take longer steps
+	bool anisotropic = false;
+	float coneStepScale = 1.f; // cone steps are this many times the cone's diameter
+
+	// sparse voxel octree for cones narrower than a baked voxel, its leaves reach single scan voxels wherever 
+	// there's content so near surface shadows don't have to read the coarse bake. 24 bytes per node
+	bool svo = false;
+	uint32_t svoMaxNodes = 1 << 21;
+	float svoSubdivideOpacity = 0.002f; // nodes with less average opacity than this stay leaves
+
+	// summed-area table of the bake's extinction so cones wider than a baked voxel average exactly over a box their 
+	// width instead of blending two mips. Fp32 is 4 bytes per baked voxel, Split keeps a float-float sum in 8 bytes 
+	// for bakes big enough that the far corner's sums lose the precision of their differences
+	enum class SummedAreaTable : GLuint { Off = 0, Fp32 = 1, Split = 2 };
+	SummedAreaTable summedAreaTable = SummedAreaTable::Off;
+
+	// coarse grid of probes holding order 1 sh of the environment radiance reaching them through the bake, filled a
+	// slab at a time in the background. Diffuse samples read it instead of cone tracing once the probes around them 
+	// have converged, so each iteration gets cheaper as the cache fills
+	bool radianceCache = false;
+	uint32_t radianceCacheSize = 32; // probes per axis
+	uint32_t radianceCacheSlices = 4; // slices of probes in each slab
+	uint32_t radianceCacheRays = 32; // rays each probe of the current slab adds per frame
+	uint32_t radianceCacheSamples = 1024; // rays a probe needs before it's used
+
+	// precomputed radiance transfer: order 1 sh of every voxel's visibility of the environment, built once per 
+	// transfer function. Diffuse samples light themselves with a dot product against the environment's projection 
+	// instead of cone tracing, so rotating or switching the environment reconverges in a few iterations
+	bool prt = false;
+	uint32_t prtSize = 64; // voxels per axis
+	uint32_t prtRays = 128; // rays per voxel
+
+	// multiple scattering: scales each sample's single scattering by a table of the extra light bounces would add 
+	// through a homogeneous neighbourhood of this radius (in the volume's [0, 1] texture space) with the bake's 
+	// density around it, built once at startup. Brightens thick, light colored tissue without tracing more bounces
+	bool multipleScattering = false;
+	float multipleScatteringRadius = 0.05f;
+
+	// bounces every path can take (up to 8), each adds the direct lighting at the vertex it finds. Paths past the 
+	// first bounce are ended by russian roulette on their throughput
+	uint32_t maxBounces = 1;
+
+	// temporal reuse: restarting accumulation for a camera move (or the quality governor) reprojects every sample's 
+	// accumulation from the last view where its pixel's first hit matches the last one in position and normal, instead 
+	// of throwing it away. History counts as at most temporalMaxHistory samples, the rest converge on top of it
+	bool temporalReuse = false;
+	uint32_t temporalMaxHistory = 64;
+
+	// screen rect: every iteration the volume's box is projected to a conservative screen rectangle, full screen 
+	// passes only dispatch over that and the pixels outside it get the environment once per restart
+	bool screenRect = false;
+
+	// entry cache: on every restart the distance each pixel's camera rays can first reach content is found from a 
+	// coarse mip of the bake, camera rays start marching there and pixels with no content in the way are given the 
+	// environment once instead of every iteration. entryCacheLevel is the bake mip the search steps through
+	bool entryCache = false;
+	uint32_t entryCacheLevel = 3;
+
+	// persistent threads: the trace pass runs persistentGroups workgroups whose lanes take rays from a global counter,
+	// a lane takes the next ray in between march steps as soon as its own is done instead of waiting for the slowest ray
+	// of its warp. schedulerStats logs how many of the march steps the pass's workgroups were resident for had a lane 
+	// marching, next to the pass's gpu time
+	bool persistentThreads = false;
+	uint32_t persistentGroups = 256;
+	bool schedulerStats = false;
+
+	// adaptive sampling: before every iteration the spread of each pixel's samples estimates its noise, 16x16 tiles 
+	// whose worst pixel is under the threshold (relative standard error) stop being traced and the rest take samples
+	// in proportion to their noise. Everything is traced for the first adaptiveMinItrs iterations
+	bool adaptiveSampling = false;
+	float adaptiveThreshold = 0.01f;
+	uint32_t adaptiveMinItrs = 16;
+
+	// wavefront: camera rays that miss the volume's box and paths that end at the first hit are compacted out of 
+	// per stage ray queues, and the trace and direct passes are dispatched indirectly over just the live rays 
+	// instead of the whole framebuffer. Costs 4 bytes per sample per queue
+	bool wavefront = false;
+
+	// explicit lights are shadowed by a cached volume of the transmittance towards each of them (up to 4, one per 
+	// channel) rebuilt whenever the lights or the bake change, so shading takes one fetch instead of a shadow ray
+	uint32_t lightVolumeSize = 64; // voxels per axis
+
+	// when the transfer functions change the bake is redone a slab at a time over this many frames, accumulation 
+	// restarts once it and everything derived from it are rebuilt
+	uint32_t rebakeFrames = 8;
+};
+
 class RaytracePass
 {
 public:
-	RaytracePass(const glm::ivec2& size, const uint32_t samples, std::shared_ptr<Dicom> dicom, GLuint transferLUT, GLuint opacityLUT);
+	RaytracePass(const glm::ivec2& size, const uint32_t samples, std::shared_ptr<Dicom> dicom, GLuint transferLUT, GLuint opacityLUT, 
+		const RaytraceSettings& settings = RaytraceSettings());
 
 	void Execute(GLuint transferLUT, GLuint opacityLUT, GLuint clearcoatLUT, GLuint cubemap, GLuint volume);
 
@@ -21,18 +156,86 @@ public:
 	void SetView(const glm::mat4& view) { mView = view; }
 	void SetPhysicalSize(const glm::vec3& physicalSize) { mPhysicalSize = physicalSize; }
 
+	// Rotation applied to the environment, restarts accumulation when it changes
+	void SetEnvironmentRotation(const glm::mat3& rotation);
+
+	// Lights shaded alongside the environment, only the first 4 are used. Restarts accumulation
+	void SetLights(const std::vector<Light>& lights);
+
+	// Version of the luts passed to Execute, bumping it re-bakes everything derived from them
+	void SetTransferFunctionVersion(uint32_t version) { mTransferFunctionVersion = version; }
+
 	void SetItrs(int itrs) { mItrs = itrs; }
 	int GetItrs() const { return mItrs; }
 
+	// Lets the quality governor trace only the first activeSamples of every pixel's samples and lengthen the march 
+	// and cone steps by stepScale, accumulation restarts when either changes
+	void SetQuality(uint32_t activeSamples, float stepScale);
+	uint32_t GetActiveSamples() const { return mActiveSamples; }
+
+	// Renders into the top left scale-sized corner of the ray textures, DrawQuad upscales it to the window. 
+	// Accumulation restarts when the size changes
+	void SetRenderScale(float scale);
+	glm::ivec2 GetRenderSize() const { return mRenderSize; }
+
+	// Gpu time of the latest Execute that has come back, 0 before the first one has
+	double GetIterationMs() const { return mIterationTimer.GetLastMs(); }
+
+	// Average gpu time of each pass so far
+	void LogTimings(std::ostream& out) const;
+
 private:
+	void Bake(GLuint transferLUT, GLuint opacityLUT, GLint firstSlice, GLint numSlices);
+	void UpdateBake(GLuint transferLUT, GLuint opacityLUT);
+	void BuildMips();
+	void BuildAnisotropicMips();
+	void BuildSvo(GLuint transferLUT, GLuint opacityLUT, bool logStats);
+	void BuildSummedAreaTable(bool logStats);
+	void UpdateRadianceCache(GLuint cubemap);
+	void ResetRadianceCache();
+	void BuildPrt(GLint firstSlice, GLint numSlices);
+	void ProjectEnvironment(GLuint cubemap);
+	void BuildLightVolume();
+	void BuildMultipleScatteringLUT();
+	void ClearQueue(const UniqueBuffer& queue);
+	void PrepareQueue(const UniqueBuffer& queue, GLuint itemsPerGroup = 256, GLuint groupsPerItem = 1);
+	void FindUnconvergedTiles();
+	void BuildEntryCache();
+	void FindFirstHits(bool reproject);
+	void UpdateScreenRect();
+	void Preclassify(GLuint transferLUT, GLuint opacityLUT);
+	void PrecomputeGradient();
+
 	ComputeProgram mRaytraceProgram;
 	ComputeProgram mGenRaysProgram;
 	ComputeProgram mDenoiseProgram;
 	ComputeProgram mPrecomputeProgram;
 	ComputeProgram mConeTraceProgram;
+	ComputeProgram mClassifyProgram;
+	ComputeProgram mGradientProgram;
+	ComputeProgram mMipmapProgram;
+	ComputeProgram mAnisoMipmapProgram;
+	ComputeProgram mSvoBuildProgram;
+	ComputeProgram mSatScanProgram;
+	ComputeProgram mRadianceCacheProgram;
+	ComputeProgram mPrtProgram;
+	ComputeProgram mEnvShProgram;
+	ComputeProgram mLightVolumeProgram;
+	ComputeProgram mMultipleScatteringProgram;
+	ComputeProgram mQueueArgsProgram;
+	ComputeProgram mTileErrorProgram;
+	ComputeProgram mEntryCacheProgram;
+	ComputeProgram mEnvFillProgram;
+	ComputeProgram mFirstHitProgram;
 	glm::ivec2 mSize;
+	glm::ivec2 mRenderSize; // see SetRenderScale
+	glm::ivec2 mScreenRectMin; // the part of the render the volume's box projects to, see UpdateScreenRect
+	glm::ivec2 mScreenRectMax;
 	uint32_t mNumSamples;
+	uint32_t mActiveSamples; // samples per pixel traced per iteration, see SetQuality
+	float mStepScale;
 	std::weak_ptr<Dicom> mDicom;
+	RaytraceSettings mSettings;
 
 	//pos: xyzw -> xyz-theta
 	//accum: xyzw -> rgb-phi
@@ -41,6 +244,65 @@ private:
 	UniqueTexture mColorTexture;
 	UniqueTexture mDenoiseTexture;
 	UniqueTexture mBakedVolumeTexture;
+	UniqueTexture mAnisoVolumeTexture;
+	UniqueTexture mSatVolumeTexture;
+	std::array<UniqueTexture, 3> mRadianceCacheTextures; // sh coefficients of r, g and b
+	UniqueTexture mRadianceCacheCountTexture;
+	UniqueTexture mPrtVolumeTexture;
+	UniqueBuffer mEnvShBuffer;
+	UniqueTexture mLightVolumeTexture;
+	UniqueTexture mLightTexture; // light each sample's explicit lights add, written by the trace and read by the direct pass
+	UniqueTexture mWeightTexture; // weight each sample was averaged in with, later bounces add to it with the same weight
+	UniqueTexture mGBufferTexture; // deterministic first hit of every pixel, see first_hit.glsl
+	UniqueTexture mHistoryGBufferTexture; // the same as of the view mHistoryTexture was accumulated in
+	UniqueTexture mReprojectTexture; // per pixel previous pixel and confidence its history is taken over with
+	UniqueTexture mHistoryTexture; // imgOutput before a restart
+	UniqueTexture mEntryTexture; // per screen pixel distance to the first content, see entry_cache.glsl
+	UniqueTexture mMultipleScatteringTexture;
+	UniqueTexture mClassifiedVolumeTexture;
+	PreintegratedTable mPreintegratedTable;
+	UniqueTexture mGradientVolumeTexture;
+	UniqueBuffer mSvoNodeBuffer;
+	UniqueBuffer mSvoCounterBuffer;
+	UniqueBuffer mTraceQueueBuffer; // (indirect args, count, pixels) of the rays left to trace
+	UniqueBuffer mDirectQueueBuffer; // same for the rays left for the direct pass
+	UniqueBuffer mTileQueueBuffer; // (indirect args, count, tiles) of the tiles adaptive sampling still traces
+	UniqueBuffer mRaySchedulerBuffer; // next ray and step counts of the trace pass, see persistent.glsl
+
+	GpuTimer mIterationTimer;
+	GpuTimer mGenRaysTimer;
+	GpuTimer mTraceTimer;
+	GpuTimer mConeTraceTimer;
+	GpuTimer mTileTimer;
+	GpuTimer mEntryCacheTimer;
+	std::array<GpuTimer, 8> mBounceTimers; // trace and direct pass of every bounce past the first, [0] is unused
+	GpuTimer mBakeTimer;
+	GpuTimer mMipTimer;
+	GpuTimer mRadianceCacheTimer;
+
+	glm::ivec3 mBakeSize;
+	GLint mBakeLevels;
+
+	uint32_t mTransferFunctionVersion;
+	uint32_t mBakedVersion;
+	GLint mRebakeSlice; // next slice to re-bake, the bake is up to date when it's past the last one
+
+	GLuint mSvoDepth; // 0 without an octree
+
+	GLint mRadianceCacheSlice; // first slice of the slab being filled, the cache is full when it's past the last one
+	uint32_t mRadianceCacheSlabRays;
+	uint32_t mRadianceCacheUpdates;
+
+	GLint mPrtSlice; // next slice of the transfer volume to rebuild, it's up to date when it's past the last one
+
+	GLuint mEnvShCubemap; // cubemap the environment sh was projected from
+	glm::mat3 mEnvRotation;
+
+	std::array<glm::vec4, 4> mLightPositions; // w is the light's type
+	std::array<glm::vec4, 4> mLightColors;
+	GLint mNumLights;
+	bool mLightsDirty;
+	bool mLightVolumeBuilt; // only the first build is logged, re-bakes rebuild it after every transfer function edit
 
 	glm::vec3 mPhysicalSize;
 	glm::vec3 mScaleFactor;
@@ -48,5 +310,13 @@ private:
 	glm::mat4 mView;
 
 	int mItrs;  
+	int mConvergedItrs; // iteration every tile was found converged at, 0 until then
+
+	// temporal reuse: the state the last iteration rendered with, which the accumulation is reprojected from when 
+	// accumulation restarts, unless what was rendered changed
+	glm::mat4 mLastView;
+	glm::ivec2 mLastRenderSize;
+	uint32_t mLastActiveSamples;
+	bool mHistoryValid;
 };
 
@@ -57,6 +57,13 @@ Window::Window(const glm::ivec2& size, std::string title)
 			listener.lock()->HandleScroll(gWindowMap[window], glm::dvec2(xoffset, yoffset));
 		}
 	});
+
+	glfwSetKeyCallback(mWindow, [](GLFWwindow* window, int key, int scancode, int action, int mods) {
+		for (auto& listener : gWindowMap[window]->mKeyListeners)
+		{
+			listener.lock()->HandleKey(gWindowMap[window], key, scancode, action, mods);
+		}
+	});
 }
 
 Window::~Window()
@@ -79,4 +86,14 @@ void Window::AddMouseListener(std::shared_ptr<MouseListener> listener)
 	}
 
 	mListeners.push_back(listener); 
+}
+
+void Window::AddKeyListener(std::shared_ptr<KeyListener> listener)
+{
+	if (gWindowMap.find(mWindow) == gWindowMap.end())
+	{
+		gWindowMap[mWindow] = shared_from_this();
+	}
+
+	mKeyListeners.push_back(listener);
 }
\ No newline at end of file
@@ -18,6 +18,12 @@ public:
 	virtual void HandleScroll(std::shared_ptr<Window> window, const glm::dvec2& offset) {}
 };
 
+class KeyListener
+{
+public:
+	virtual void HandleKey(std::shared_ptr<Window> window, int key, int scancode, int action, int mods) {}
+};
+
 class Window : public std::enable_shared_from_this<Window>
 {
 public:
@@ -26,14 +32,17 @@ public:
 
 	inline bool ShouldClose() const { return glfwWindowShouldClose(mWindow); }
 	inline void SwapBuffers() { glfwSwapBuffers(mWindow); }
+	inline void SetVsync(bool vsync) { glfwSwapInterval(vsync ? 1 : 0); }
 
 	glm::vec2 GetMousePos() const;
 	void AddMouseListener(std::shared_ptr<MouseListener> listener);
+	void AddKeyListener(std::shared_ptr<KeyListener> listener);
 	glm::ivec2 GetFramebufferSize() const { return mFramebufferSize; }
 
 private:
 	glm::ivec2 mFramebufferSize;
 	std::vector<std::weak_ptr<MouseListener>> mListeners;
+	std::vector<std::weak_ptr<KeyListener>> mKeyListeners;
 	GLFWwindow* mWindow;
 };
 
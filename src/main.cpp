@@ -9,6 +9,7 @@
 #include <filesystem>
 #include <variant>
 #include <chrono>
+#include <sstream>
 
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
@@ -126,7 +127,6 @@ public:
 		: mLastCachedView(initial)
 		, mDragStartPos()
 		, mCurrDelta()
-		, mViewDirtied(false)
 		, mResample(true)
 	{}
 
@@ -146,13 +146,11 @@ public:
 			{
 				mDragStartPos = window->GetMousePos();
 				mCurrDelta = glm::mat4(1.f);
-				mViewDirtied = true;
 			}
 			else if (action == GLFW_RELEASE)
 			{
 				mDragStartPos.reset();
 				mCurrDelta.reset();
-				mViewDirtied = false;
 				mLastCachedView = *mCurrDelta * mLastCachedView;
 			}
 		}
@@ -172,7 +170,6 @@ public:
 		mLastCachedView[3][0] *= scaleFactor;
 		mLastCachedView[3][1] *= scaleFactor;
 		mLastCachedView[3][2] *= scaleFactor;
-		mViewDirtied = true;
 	}
 
 	glm::mat4 GetView() const
@@ -189,13 +186,6 @@ public:
 		return mResample;
 	}
 
-	bool GetIsViewDirtied() const
-	{
-		bool temp = mViewDirtied;
-		//mViewDirtied = false;
-		return temp;
-	}
-
 private:
 	inline glm::mat4 CalcRot(std::shared_ptr<Window> window)
 	{
@@ -210,10 +200,227 @@ private:
 	std::optional<glm::vec2> mDragStartPos;
 	std::optional<glm::mat4> mCurrDelta;
 	glm::mat4 mLastCachedView;
-	bool mViewDirtied;
 	bool mResample;
 };
 
+// Arrow keys edit the opacity ramp while rendering, left/right slide it along the density axis and up/down change 
+// how steep it is
+class TransferFunctionController : public KeyListener
+{
+public:
+	TransferFunctionController(float rampStart, float rampEnd)
+		: mRampStart(rampStart)
+		, mRampEnd(rampEnd)
+		, mChanged(false)
+	{}
+
+	void HandleKey(std::shared_ptr<Window> window, int key, int scancode, int action, int mods) override
+	{
+		if (action == GLFW_RELEASE)
+		{
+			return;
+		}
+
+		const float step = .01f;
+		if (key == GLFW_KEY_LEFT || key == GLFW_KEY_RIGHT)
+		{
+			const float offset = std::clamp(key == GLFW_KEY_LEFT ? -step : step, -mRampStart, 1.f - mRampEnd);
+			mRampStart += offset;
+			mRampEnd += offset;
+			mChanged = true;
+		}
+		else if (key == GLFW_KEY_UP || key == GLFW_KEY_DOWN)
+		{
+			mRampEnd = std::clamp(mRampEnd + (key == GLFW_KEY_UP ? step : -step), mRampStart + step, 1.f);
+			mChanged = true;
+		}
+	}
+
+	// Rebuilds the opacity function if the ramp was edited since the last call
+	bool Update(PLF<float, float>& opacityTF)
+	{
+		if (!mChanged)
+		{
+			return false;
+		}
+
+		opacityTF.ClearStops();
+		opacityTF.AddStop(0.f, 0.f);
+		opacityTF.AddStop(mRampStart, 0.f);
+		opacityTF.AddStop(mRampEnd, 1.f);
+		opacityTF.AddStop(1.f, 1.f);
+		mChanged = false;
+		return true;
+	}
+
+private:
+	float mRampStart;
+	float mRampEnd;
+	bool mChanged;
+};
+
+// Q/E spin the environment around the vertical axis
+class EnvironmentController : public KeyListener
+{
+public:
+	EnvironmentController()
+		: mAngle(0.f)
+	{}
+
+	void HandleKey(std::shared_ptr<Window> window, int key, int scancode, int action, int mods) override
+	{
+		if (action != GLFW_RELEASE && (key == GLFW_KEY_Q || key == GLFW_KEY_E))
+		{
+			mAngle += glm::radians(key == GLFW_KEY_Q ? -10.f : 10.f);
+		}
+	}
+
+	glm::mat3 GetRotation() const
+	{
+		return glm::mat3(glm::rotate(mAngle, glm::vec3(0.f, 1.f, 0.f)));
+	}
+
+private:
+	float mAngle;
+};
+
+// Lowers the quality of each iteration while the camera moves so an iteration keeps fitting in the frame budget, 
+// and goes back to full quality as soon as it stops. Motion starts at the interactive render scale, levels then go 
+// down to a quarter scale, halve the samples per pixel down to 1 and finally lengthen the march and cone steps. The 
+// level reached is kept for the next time the camera moves
+class QualityGovernor
+{
+public:
+	struct Level
+	{
+		uint32_t samples;
+		float stepScale;
+		float renderScale;
+	};
+
+	QualityGovernor(uint32_t numSamples, double targetMs, float renderScale, float interactiveRenderScale)
+		: mFull({ numSamples, 1.f, renderScale })
+		, mLevels()
+		, mFramesAtLevel()
+		, mTargetMs(targetMs)
+		, mLevel(0)
+		, mCooldown(0)
+		, mInteracting(false)
+		, mDowngrades(0)
+		, mUpgrades(0)
+	{
+		const float minScale = std::min(interactiveRenderScale, 0.25f);
+		mLevels.push_back({ numSamples, 1.f, interactiveRenderScale });
+		if (minScale < interactiveRenderScale)
+		{
+			mLevels.push_back({ numSamples, 1.f, minScale });
+		}
+		for (uint32_t samples = numSamples / 2; samples > 1; samples /= 2)
+		{
+			mLevels.push_back({ samples, 1.f, minScale });
+		}
+		if (numSamples > 1)
+		{
+			mLevels.push_back({ 1, 1.f, minScale });
+		}
+		for (float stepScale : { 1.5f, 2.f, 3.f })
+		{
+			mLevels.push_back({ 1, stepScale, minScale });
+		}
+		mFramesAtLevel.resize(mLevels.size(), 0);
+	}
+
+	// Called once a frame with the gpu time of the latest iteration that has come back, returns the quality the 
+	// next iterations should use
+	const Level& Update(bool interacting, double iterationMs)
+	{
+		if (interacting != mInteracting)
+		{
+			mInteracting = interacting;
+			mCooldown = timerLatency;
+			if (mLevel != 0 || mLevels.front().renderScale != mFull.renderScale)
+			{
+				std::cout << "quality governor: camera " << (interacting ? "moving, " : "stopped, ") << Describe(GetLevel()) << "\n";
+			}
+		}
+
+		if (!mInteracting)
+		{
+			return GetLevel();
+		}
+
+		mFramesAtLevel[mLevel]++;
+
+		// timings of the last few iterations were taken at the old level
+		if (mCooldown > 0 || iterationMs <= 0.0)
+		{
+			mCooldown = std::max(mCooldown - 1, 0);
+			return GetLevel();
+		}
+
+		size_t level = mLevel;
+		if (iterationMs > mTargetMs && mLevel + 1 < mLevels.size())
+		{
+			level++;
+			mDowngrades++;
+		}
+		else if (iterationMs < mTargetMs * upgradeHeadroom && mLevel > 0)
+		{
+			level--;
+			mUpgrades++;
+		}
+
+		if (level != mLevel)
+		{
+			std::cout << "quality governor: " << iterationMs << " ms per iteration against " << mTargetMs << " ms, " << Describe(mLevels[level]) << "\n";
+			mLevel = level;
+			mCooldown = timerLatency;
+		}
+
+		return GetLevel();
+	}
+
+	const Level& GetLevel() const
+	{
+		return mInteracting ? mLevels[mLevel] : mFull;
+	}
+
+	// Frames spent at each level while the camera moved and how often the level changed
+	void LogMetrics(std::ostream& out) const
+	{
+		out << "quality governor: " << mDowngrades << " downgrades, " << mUpgrades << " upgrades, interactive frames at";
+		for (size_t level = 0; level < mLevels.size(); level++)
+		{
+			out << (level ? ", " : " ") << Describe(mLevels[level]) << " " << mFramesAtLevel[level];
+		}
+		out << "\n";
+	}
+
+private:
+	// frames a change takes to show up in the gpu timers, see GpuTimer's ring
+	static constexpr int timerLatency = 4;
+
+	// a level up has to fit with room to spare since every level down roughly halves the time
+	static constexpr double upgradeHeadroom = 0.4;
+
+	static std::string Describe(const Level& level)
+	{
+		std::ostringstream out;
+		out << level.samples << " spp, step x" << level.stepScale << ", scale " << level.renderScale;
+		return out.str();
+	}
+
+	Level mFull;
+	std::vector<Level> mLevels;
+	std::vector<uint32_t> mFramesAtLevel;
+	double mTargetMs;
+	size_t mLevel;
+	int mCooldown;
+	bool mInteracting;
+	uint32_t mDowngrades;
+	uint32_t mUpgrades;
+};
+
 struct ImageWriter
 {
 	std::string mFolder;
@@ -281,6 +488,128 @@ struct ImageWriter
 	}
 };
 
+// Optional "render settings" block of the config, anything left out keeps the RaytraceSettings default
+RaytraceSettings LoadRaytraceSettings(const YAML::Node& node)
+{
+	RaytraceSettings settings;
+	if (!node)
+	{
+		return settings;
+	}
+
+	settings.coarseStepScale = node["coarse step scale"].as<float>(settings.coarseStepScale);
+	settings.refineSteps = node["refine steps"].as<uint32_t>(settings.refineSteps);
+
+	const std::string classification = node["classification"].as<std::string>("post");
+	if (classification == "pre")
+	{
+		settings.classification = RaytraceSettings::Classification::Pre;
+	}
+	else if (classification == "preintegrated")
+	{
+		settings.classification = RaytraceSettings::Classification::PreIntegrated;
+	}
+	settings.preclassifiedFormat = node["preclassified bits"].as<int>(8) == 16 ? GL_RGBA16 : GL_RGBA8;
+	settings.preintegratedSize = node["preintegrated size"].as<uint32_t>(settings.preintegratedSize);
+
+	const std::string gradient = node["gradient"].as<std::string>("runtime");
+	if (gradient == "central")
+	{
+		settings.gradient = RaytraceSettings::Gradient::Central;
+	}
+	else if (gradient == "sobel")
+	{
+		settings.gradient = RaytraceSettings::Gradient::Sobel;
+	}
+	settings.gradientFormat = node["gradient bits"].as<int>(10) == 16 ? GL_RGBA16 : GL_RGB10_A2;
+
+	settings.bakeBudgetMB = node["bake budget mb"].as<float>(settings.bakeBudgetMB);
+
+	const std::string mipReduction = node["mip reduction"].as<std::string>("extinction average");
+	if (mipReduction == "max")
+	{
+		settings.mipReduction = RaytraceSettings::MipReduction::Max;
+	}
+	else if (mipReduction == "opacity weighted")
+	{
+		settings.mipReduction = RaytraceSettings::MipReduction::OpacityWeighted;
+	}
+	settings.anisotropic = node["anisotropic"].as<bool>(settings.anisotropic);
+	settings.coneStepScale = node["cone step scale"].as<float>(settings.coneStepScale);
+	settings.svo = node["svo"].as<bool>(settings.svo);
+	settings.svoMaxNodes = node["svo max nodes"].as<uint32_t>(settings.svoMaxNodes);
+	settings.svoSubdivideOpacity = node["svo subdivide opacity"].as<float>(settings.svoSubdivideOpacity);
+
+	const std::string summedAreaTable = node["summed area table"].as<std::string>("off");
+	if (summedAreaTable == "fp32")
+	{
+		settings.summedAreaTable = RaytraceSettings::SummedAreaTable::Fp32;
+	}
+	else if (summedAreaTable == "split")
+	{
+		settings.summedAreaTable = RaytraceSettings::SummedAreaTable::Split;
+	}
+
+	settings.radianceCache = node["radiance cache"].as<bool>(settings.radianceCache);
+	settings.radianceCacheSize = node["radiance cache size"].as<uint32_t>(settings.radianceCacheSize);
+	settings.radianceCacheSlices = node["radiance cache slices"].as<uint32_t>(settings.radianceCacheSlices);
+	settings.radianceCacheRays = node["radiance cache rays"].as<uint32_t>(settings.radianceCacheRays);
+	settings.radianceCacheSamples = node["radiance cache samples"].as<uint32_t>(settings.radianceCacheSamples);
+
+	settings.prt = node["prt"].as<bool>(settings.prt);
+	settings.prtSize = node["prt size"].as<uint32_t>(settings.prtSize);
+	settings.prtRays = node["prt rays"].as<uint32_t>(settings.prtRays);
+	settings.multipleScattering = node["multiple scattering"].as<bool>(settings.multipleScattering);
+	settings.multipleScatteringRadius = node["multiple scattering radius"].as<float>(settings.multipleScatteringRadius);
+	settings.maxBounces = node["max bounces"].as<uint32_t>(settings.maxBounces);
+	settings.wavefront = node["wavefront"].as<bool>(settings.wavefront);
+	settings.temporalReuse = node["temporal reuse"].as<bool>(settings.temporalReuse);
+	settings.temporalMaxHistory = node["temporal max history"].as<uint32_t>(settings.temporalMaxHistory);
+	settings.screenRect = node["screen rect"].as<bool>(settings.screenRect);
+	settings.entryCache = node["entry cache"].as<bool>(settings.entryCache);
+	settings.entryCacheLevel = node["entry cache level"].as<uint32_t>(settings.entryCacheLevel);
+	settings.persistentThreads = node["persistent threads"].as<bool>(settings.persistentThreads);
+	settings.persistentGroups = node["persistent groups"].as<uint32_t>(settings.persistentGroups);
+	settings.schedulerStats = node["scheduler stats"].as<bool>(settings.schedulerStats);
+	settings.adaptiveSampling = node["adaptive sampling"].as<bool>(settings.adaptiveSampling);
+	settings.adaptiveThreshold = node["adaptive threshold"].as<float>(settings.adaptiveThreshold);
+	settings.adaptiveMinItrs = node["adaptive min itrs"].as<uint32_t>(settings.adaptiveMinItrs);
+	settings.lightVolumeSize = node["light volume size"].as<uint32_t>(settings.lightVolumeSize);
+	settings.rebakeFrames = node["rebake frames"].as<uint32_t>(settings.rebakeFrames);
+	return settings;
+}
+
+// Optional "lights" list of the config, each entry is a directional light with a direction or a point light with a 
+// position, in the volume's [0, 1] texture space
+std::vector<Light> LoadLights(const YAML::Node& node)
+{
+	std::vector<Light> lights;
+	if (!node)
+	{
+		return lights;
+	}
+
+	for (YAML::const_iterator it = node.begin(); it != node.end(); it++)
+	{
+		const YAML::Node& lightNode = *it;
+
+		Light light;
+		if (lightNode["type"].as<std::string>("directional") == "point")
+		{
+			light.type = Light::Type::Point;
+			light.vector = lightNode["position"].as<glm::vec3>(glm::vec3(0.5f));
+		}
+		else
+		{
+			light.vector = lightNode["direction"].as<glm::vec3>(light.vector);
+		}
+		light.color = lightNode["color"].as<glm::vec3>(light.color) * lightNode["intensity"].as<float>(1.f);
+		lights.push_back(light);
+	}
+
+	return lights;
+}
+
 void GLAPIENTRY MessageCallback(GLenum source,
 	GLenum type,
 	GLuint id,
@@ -368,6 +697,12 @@ int main(int argc, char* argv[])
 	glActiveTexture(GL_TEXTURE0);
 	opacityTF.EvaluateTexture(100);
 
+	std::shared_ptr<TransferFunctionController> transferFunctionController = std::make_shared<TransferFunctionController>(0.3f, .5f);
+	win->AddKeyListener(transferFunctionController);
+
+	std::shared_ptr<EnvironmentController> environmentController = std::make_shared<EnvironmentController>();
+	win->AddKeyListener(environmentController);
+
 	using ColorPLF = PLF<float, glm::vec4>;
 	GLuint colorTF = -1;
 	std::unique_ptr<HSVTransferFunction> hsvTF;
@@ -440,20 +775,56 @@ int main(int argc, char* argv[])
 	std::shared_ptr<Dicom> dicom = std::make_shared<Dicom>(scanFolder);
 
 	const uint32_t numSamples = 8;
-	RaytracePass raytracePass(size, numSamples, dicom, colorTF, opacityTF.Unique().Get());
+	const RaytraceSettings raytraceSettings = LoadRaytraceSettings(config["render settings"]);
+	RaytracePass raytracePass(size, numSamples, dicom, colorTF, opacityTF.Unique().Get(), raytraceSettings);
 	raytracePass.SetPhysicalSize(volumeScale);
+	raytracePass.SetLights(LoadLights(config["lights"]));
+
+	// the pass baked the luts as they are now, only later evaluations count as changes
+	const uint32_t initialTransferFunctionVersion = opacityTF.Version();
 
 	Cubemap cubemap(cubemapFiles);
 
-	DrawQuad drawQuad = DrawQuad(size, numSamples);
+	DrawQuad drawQuad = DrawQuad(win->GetFramebufferSize(), numSamples);
 
 	ImageWriter imageWriter = ImageWriter(scanFolder);
 	bool imageWritten = false;
 	int requiredItrs = config["itrs"].as<int>();
+
+	// as many iterations as fit in the budget of gpu time run between two presented frames
+	static const int maxItrsPerFrame = 64;
+	const double frameBudgetMs = config["frame budget"].as<double>(12.0);
+	int itrsPerFrame = 1;
+
+	// the camera moves at a lower resolution and the governor trades more quality for speed if a single iteration 
+	// still doesn't fit in the budget
+	const float renderScale = glm::clamp(config["render scale"].as<float>(1.f), 0.1f, 1.f);
+	const float interactiveRenderScale = glm::clamp(config["interactive render scale"].as<float>(0.5f), 0.1f, renderScale);
+	std::optional<QualityGovernor> governor;
+	if (config["quality governor"].as<bool>(true))
+	{
+		governor.emplace(numSamples, frameBudgetMs, renderScale, interactiveRenderScale);
+	}
+
+	// the camera counts as moving until its view has stayed the same for a few frames, so frames the mouse didn't 
+	// report a move in don't drop back to full quality
+	static const int settleFrames = 4;
+	glm::mat4 lastView = viewController->GetView();
+	int framesSinceMove = settleFrames;
+
+	// a final render shouldn't wait on the display between frames
+	win->SetVsync(requiredItrs == 0);
+
 	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
 	while (!win->ShouldClose())
 	{
-		if (viewController->GetIsViewDirtied())
+		const glm::mat4 view = viewController->GetView();
+		const bool viewMoved = view != lastView;
+		lastView = view;
+		framesSinceMove = viewMoved ? 0 : std::min(framesSinceMove + 1, settleFrames);
+		const bool interacting = framesSinceMove < settleFrames;
+
+		if (viewMoved)
 		{
 			raytracePass.SetItrs(1);
 		}
@@ -462,15 +833,57 @@ int main(int argc, char* argv[])
 		{
 			std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
 			std::cout << "Time difference = " << std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count() << "[us]" << std::endl;
+			raytracePass.LogTimings(std::cout);
+			if (governor)
+			{
+				governor->LogMetrics(std::cout);
+			}
 			imageWriter.WriteImage(win.get());
 			imageWritten = true;
+			win->SetVsync(true);
 		}
 
-		const glm::mat4 view = viewController->GetView();
+		if (transferFunctionController->Update(opacityTF))
+		{
+			opacityTF.EvaluateTexture(100);
+			raytracePass.SetTransferFunctionVersion(opacityTF.Version() - initialTransferFunctionVersion);
+		}
+
+		raytracePass.SetEnvironmentRotation(environmentController->GetRotation());
+
 		raytracePass.SetView(view);
-		raytracePass.Execute(colorTF, opacityTF.Unique().Get(), clearcoatPF.Unique().Get(), cubemap.Unique().Get(), dicom->GetTexture().Get());
 
-		drawQuad.Execute(raytracePass.GetColorTexture());
+		if (governor)
+		{
+			const QualityGovernor::Level& level = governor->Update(interacting, raytracePass.GetIterationMs());
+			raytracePass.SetQuality(level.samples, level.stepScale);
+			raytracePass.SetRenderScale(level.renderScale);
+		}
+		else
+		{
+			raytracePass.SetRenderScale(interacting ? interactiveRenderScale : renderScale);
+		}
+
+		// stop exactly on itrs so the image is written from the iteration it asks for
+		int frameItrs = itrsPerFrame;
+		if (requiredItrs != 0 && !imageWritten)
+		{
+			frameItrs = std::max(std::min(frameItrs, requiredItrs - raytracePass.GetItrs()), 1);
+		}
+
+		for (int i = 0; i < frameItrs; i++)
+		{
+			raytracePass.Execute(colorTF, opacityTF.Unique().Get(), clearcoatPF.Unique().Get(), cubemap.Unique().Get(), dicom->GetTexture().Get());
+		}
+
+		// the timings come back a few iterations late, which is close enough to size the next frame with
+		const double iterationMs = raytracePass.GetIterationMs();
+		if (iterationMs > 0.0)
+		{
+			itrsPerFrame = glm::clamp(int(frameBudgetMs / iterationMs), 1, maxItrsPerFrame);
+		}
+
+		drawQuad.Execute(raytracePass.GetColorTexture(), raytracePass.GetActiveSamples(), raytracePass.GetRenderSize());
 		glfwPollEvents();
 		win->SwapBuffers();
 	}